@@ -0,0 +1,928 @@
+/* Based on "LKD, pp.338-339" */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/completion.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/bitops.h>
+#include <linux/timekeeping.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/jump_label.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/workqueue.h>
+
+#include "primes_ioctl.h"
+#define CREATE_TRACE_POINTS
+#include "primes_trace.h"
+/* The sieve itself, shared with the userspace build primes_user.c: */
+#include "primes_engine.h"
+
+/* Bits of the bitmap per record of the debugfs file `deltas', a whole number of words: */
+#define PRIME_EXPORT_BITS 4096
+
+/* An array of kernel threads to be spawned: */
+static struct task_struct **prime_tasks;
+/* Work items queued instead of threads in workqueue mode: */
+static struct work_struct *prime_works;
+/* Workqueues of the module for workqueue=1 and workqueue=2, see prime_init(): */
+static struct workqueue_struct *prime_wq;
+static struct workqueue_struct *prime_percpu_wq;
+/* Serializes the requests made through /dev/primes: */
+static DEFINE_MUTEX(prime_dev_lock);
+/* Held while a sieve is set up or freed, so that debugfs never reads freed statistics: */
+static DEFINE_MUTEX(prime_stats_lock);
+/* The debugfs directory describing the current sieve, see prime_debugfs_init(): */
+static struct dentry *prime_dbg_dir;
+
+static unsigned long num_threads = 1;
+static unsigned long upper_bound = 10;
+module_param(num_threads, ulong, 0644);
+module_param(upper_bound, ulong, 0644);
+/* Segmented mode: each thread sieves its own segments with the base primes. */
+static bool segmented = false;
+static unsigned long segment_size = 0; /* Bits per segment, 0 for auto */
+module_param(segmented, bool, 0644);
+module_param(segment_size, ulong, 0644);
+/*
+ * Work-stealing mode: segments are sieved as in segmented mode, but each
+ * thread starts with a run of them in a deque of its own, and steals from
+ * the deque of another thread once its own runs dry. Not with sync=partitioned.
+ */
+static bool steal = false;
+module_param(steal, bool, 0644);
+/*
+ * Workqueue mode: instead of spawning threads for each sieve, queue
+ * `num_threads' work items, which share out the segments past the base
+ * primes as in segmented mode. 0 runs threads as before, 1 queues on an
+ * unbound workqueue and 2 on a per-CPU one, item k on the k-th online CPU.
+ */
+static unsigned long workqueue = 0;
+module_param(workqueue, ulong, 0644);
+/* Synchronization strategy, one of `prime_sync_names': */
+static char *prime_sync_name = "atomic";
+module_param_named(sync, prime_sync_name, charp, 0644);
+/* Bits per claim below sqrt(upper_bound) with sync=lockfree: */
+static unsigned long chunk_size = 8;
+module_param(chunk_size, ulong, 0644);
+/* How long a thread spins at the barrier before it sleeps, 0 to sleep at once: */
+static unsigned long spin_us = 50;
+module_param(spin_us, ulong, 0644);
+/* Count and time every lock acquisition and barrier round, see prime_print_locks(): */
+static bool lock_stats = false;
+module_param(lock_stats, bool, 0644);
+/* Bind the k-th thread to the k-th online CPU and keep its bitmap pages on its node: */
+static bool pin_threads = false;
+module_param(pin_threads, bool, 0644);
+/*
+ * Range mode: only [lower_bound, upper_bound] is sieved, one window of
+ * `window_size' odd integers at a time per thread, so that memory stays
+ * bounded however far out the range is. 0 leaves range mode off.
+ */
+static unsigned long lower_bound = 0;
+static unsigned long window_size = 0; /* Odd integers per window, 0 for auto */
+static bool print_primes = false;     /* Print each prime found, not only counts */
+module_param(lower_bound, ulong, 0644);
+module_param(window_size, ulong, 0644);
+module_param(print_primes, bool, 0644);
+/*
+ * Count-only mode: pi(upper_bound) is computed with the Lucy_Hedgehog
+ * algorithm, in O(upper_bound^(3/4)) time and O(sqrt(upper_bound)) memory,
+ * rather than by sieving [2, upper_bound]. Up to PRIME_COUNT_CHECK_MAX the
+ * sieve still runs as well, to check the count against. Range mode does not
+ * use it.
+ */
+static bool count_only = false;
+module_param(count_only, bool, 0644);
+/*
+ * Wheel mode: the bitmap starts out as copies of a pattern with the odd
+ * multiples of the primes dividing `wheel' already crossed out, and only
+ * larger primes are left to the threads. 0 turns it off, otherwise it must
+ * be 30, 210 or 2310. Range mode does not use it.
+ */
+static unsigned long wheel = 0;
+module_param(wheel, ulong, 0644);
+
+/* Copies the module parameters as they are now, `sync' parsed: */
+static void prime_config_load(struct prime_config *cfg)
+{
+    kernel_param_lock(THIS_MODULE);
+    cfg->num_threads = num_threads;
+    cfg->upper_bound = upper_bound;
+    cfg->lower_bound = lower_bound;
+    cfg->sync = prime_sync_name ? sysfs_match_string(prime_sync_names, prime_sync_name) : -EINVAL;
+    cfg->segmented = segmented;
+    cfg->segment_size = segment_size;
+    cfg->steal = steal;
+    cfg->workqueue = workqueue;
+    cfg->chunk_size = chunk_size;
+    cfg->spin_us = spin_us;
+    cfg->lock_stats = lock_stats;
+    cfg->pin_threads = pin_threads;
+    cfg->window_size = window_size;
+    cfg->print_primes = print_primes;
+    cfg->count_only = count_only;
+    cfg->wheel = wheel;
+    kernel_param_unlock(THIS_MODULE);
+}
+
+/**
+ * Returns the thread that crosses out most of the page `pg' of the bitmap:
+ * the owner of its range with sync=partitioned, or of its segment in
+ * segmented mode, or the thread whose deque its segment starts in. In the
+ * other modes every thread may write anywhere, so pages are simply spread
+ * over the threads in turn.
+ */
+static unsigned long prime_page_owner(unsigned long pg)
+{
+    unsigned long first = round_down(prime_from, BITS_PER_LONG);
+    unsigned long bit = pg * PAGE_SIZE * BITS_PER_BYTE;
+
+    if (((prime_sync == PRIME_SYNC_PARTITIONED) || prime_stealing || prime_cfg.segmented || prime_extending) && (bit < first))
+        return 0; /* Sieved before any thread runs */
+    if (prime_sync == PRIME_SYNC_PARTITIONED)
+        return min((bit - first) / prime_part_len(), prime_cfg.num_threads - 1);
+    if (prime_stealing)
+        return min((bit - first) / prime_seg_len * prime_cfg.num_threads / max(prime_nsegs, 1UL),
+                   prime_cfg.num_threads - 1);
+    if ((prime_cfg.segmented || prime_extending) && (prime_sync != PRIME_SYNC_LOCKFREE))
+        return ((bit - first) / prime_seg_len) % prime_cfg.num_threads;
+    return pg % prime_cfg.num_threads;
+}
+
+/**
+ * Allocates the `words' words of the bitmap and a spare one, page by page,
+ * and maps the pages contiguously, so that prime_mmap() can map them too.
+ * When threads are pinned, every page is allocated on the node of the CPU
+ * its owning thread is bound to, so that crossing out mostly stays within
+ * local memory. Pages are not zeroed, as prime_fill() sets up each of the
+ * words before it is read, in parallel: only the spare word and the rest
+ * of the last page, which mmap() shows as well, are cleared here.
+ */
+static unsigned long *prime_alloc_bits(unsigned long words)
+{
+    unsigned long *bits;
+    unsigned long pg;
+    int node;
+
+    prime_npages = DIV_ROUND_UP((words + 1) * sizeof(unsigned long), PAGE_SIZE);
+    prime_pages = (struct page **)kvcalloc(prime_npages, sizeof(struct page *), GFP_KERNEL);
+    if (prime_pages == NULL)
+        return NULL;
+    for (pg = 0; pg < prime_npages; pg++)
+    {
+        node = prime_cfg.pin_threads ? cpu_to_node(prime_cpu[prime_page_owner(pg)]) : NUMA_NO_NODE;
+        prime_pages[pg] = alloc_pages_node(node, GFP_KERNEL | __GFP_HIGHMEM, 0);
+        if (prime_pages[pg] == NULL)
+            return NULL;
+    }
+    bits = (unsigned long *)vmap(prime_pages, prime_npages, VM_MAP | VM_USERMAP, PAGE_KERNEL);
+    if (bits != NULL)
+        memset(&bits[words], 0, prime_npages * PAGE_SIZE - words * sizeof(unsigned long));
+    return bits;
+}
+
+/**
+ * Runs the work item `work' with prime_item_run(). The item is never
+ * touched again once the completion is signalled, as prime_finish() may
+ * then free it.
+ */
+static void prime_workfn(struct work_struct *work)
+{
+    prime_item_run(&prime_stats[work - prime_works]);
+}
+
+/* Frees a bitmap allocated by prime_alloc_bits(), with as many of its pages as were allocated: */
+static void prime_free_bits(unsigned long *bits, struct page **pages, unsigned long npages)
+{
+    unsigned long pg;
+
+    if (bits != NULL)
+        vunmap(bits);
+    for (pg = 0; (pages != NULL) && (pg < npages); pg++)
+    {
+        if (pages[pg] != NULL)
+            __free_page(pages[pg]);
+    }
+    kvfree(pages);
+}
+
+/**
+ * Sets up a sieve of [2, upper_bound] with prime_setup() and spawns
+ * `num_threads' threads to run it, with the parameters `cfg', which are
+ * kept in `prime_cfg'. Returns as soon as the threads are running, see
+ * prime_finish(). If `old_bits' is not NULL, it holds a finished sieve of
+ * the first `old_nbits' bits, which is copied over so that only the rest
+ * is sieved.
+ */
+static int prime_start(const struct prime_config *cfg, const unsigned long *old_bits, unsigned long old_nbits)
+{
+    unsigned long i;
+    int ret;
+
+    prime_tasks = NULL;
+    prime_works = NULL;
+    ret = prime_setup(cfg, old_bits, old_nbits);
+    if (ret != 0)
+        return ret;
+
+    /* The worker pool of the kernel runs the items, so that no thread is spawned: */
+    if (prime_queued)
+    {
+        prime_works = (struct work_struct *)kcalloc(prime_cfg.num_threads, sizeof(struct work_struct), GFP_KERNEL);
+        if (prime_works == NULL)
+        {
+            printk(KERN_ALERT "kcalloc for prime_works failed!\n");
+            prime_free();
+            return -ENOMEM;
+        }
+        atomic_set(&prime_pending, prime_cfg.num_threads);
+        WRITE_ONCE(prime_first_ns, ktime_get_ns());
+        for (i = 0; i < prime_cfg.num_threads; i++)
+        {
+            INIT_WORK(&prime_works[i], prime_workfn);
+            if (prime_cfg.workqueue == 2)
+                queue_work_on(prime_cpu[i], prime_percpu_wq, &prime_works[i]);
+            else
+                queue_work(prime_wq, &prime_works[i]);
+        }
+        return 0;
+    }
+
+    prime_tasks = (struct task_struct **)kmalloc(prime_cfg.num_threads * sizeof(struct task_struct *), GFP_KERNEL);
+    if (prime_tasks == NULL)
+    {
+        printk(KERN_ALERT "kmalloc for prime_tasks failed!\n");
+        prime_free();
+        return -ENOMEM;
+    }
+
+    /*
+     * Create every thread before waking any of them up, so that a failure
+     * never leaves the others waiting at the barrier forever. A reference
+     * is held on each thread, so that prime_exit() can reap it even after
+     * it has returned.
+     */
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        prime_tasks[i] = kthread_create_on_node(prime_threadfn, (void *)&prime_stats[i],
+                                                prime_cfg.pin_threads ? cpu_to_node(prime_cpu[i]) : NUMA_NO_NODE,
+                                                "kernel thread [%lu]", i);
+        if (IS_ERR(prime_tasks[i]))
+        {
+            printk(KERN_ERR "The %lu-th kernel thread cannot be spawned!\n", i);
+            while (i--)
+            {
+                kthread_stop(prime_tasks[i]);
+                put_task_struct(prime_tasks[i]);
+            }
+            kfree(prime_tasks);
+            prime_tasks = NULL;
+            prime_free();
+            return -EPERM;
+        }
+        get_task_struct(prime_tasks[i]);
+        if (prime_cfg.pin_threads)
+            kthread_bind(prime_tasks[i], prime_cpu[i]);
+    }
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        wake_up_process(prime_tasks[i]);
+    }
+
+    return 0;
+}
+
+/**
+ * Waits for the threads spawned, or the work items queued, by prime_start()
+ * to finish the sieve, and reaps them. Returns -EINTR if the caller is
+ * killed while waiting, in which case they are left running and reaped by
+ * the next call.
+ */
+static int prime_finish(void)
+{
+    unsigned long i;
+
+    if ((prime_tasks == NULL) && (prime_works == NULL))
+        return 0;
+    if (wait_for_completion_killable(&prime_done))
+        return -EINTR;
+    if (prime_works != NULL)
+    {
+        /* The last item may still be returning from prime_workfn(): */
+        for (i = 0; i < prime_cfg.num_threads; i++)
+        {
+            flush_work(&prime_works[i]);
+        }
+        kfree(prime_works);
+        prime_works = NULL;
+        return 0;
+    }
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        kthread_stop(prime_tasks[i]);
+        put_task_struct(prime_tasks[i]);
+    }
+    kfree(prime_tasks);
+    prime_tasks = NULL;
+    return 0;
+}
+
+/**
+ * Raises the bound of the finished sieve to that of `cfg', crossing out only
+ * past the old bound. The base primes up to sqrt(new bound) must all be
+ * within the old sieve, which they are unless the bound is squared or more.
+ */
+static int prime_extend(const struct prime_config *cfg)
+{
+    unsigned long *old_bits = prime_bits;
+    struct page **old_pages = prime_pages;
+    unsigned long old_npages = prime_npages, old_nbits = prime_nbits;
+    unsigned long i;
+    int ret;
+
+    /* The totals keep covering all of [2, new_bound]: */
+    prime_prev_cnt += prime_base_cnt;
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        prime_prev_cnt += prime_stats[i].marks;
+    }
+
+    /* Everything but the old bitmap is set up again from scratch: */
+    prime_bits = NULL;
+    prime_pages = NULL;
+    prime_free();
+    ret = prime_start(cfg, old_bits, old_nbits);
+    prime_free_bits(old_bits, old_pages, old_npages);
+    return ret;
+}
+
+/* Returns a * b mod m, for a, b < m, without overflowing 64 bits nor dividing 128-bit numbers: */
+static u64 prime_mulmod(u64 a, u64 b, u64 m)
+{
+    u64 r = 0;
+
+    if (m <= U32_MAX)
+    {
+        div64_u64_rem(a * b, m, &r);
+        return r;
+    }
+    for (; b != 0; b >>= 1)
+    {
+        if (b & 1)
+            r = (r >= m - a) ? r - (m - a) : r + a;
+        a = (a >= m - a) ? a - (m - a) : a + a;
+    }
+    return r;
+}
+
+/* Returns a^e mod m, for a < m: */
+static u64 prime_powmod(u64 a, u64 e, u64 m)
+{
+    u64 r = 1;
+
+    for (; e != 0; e >>= 1)
+    {
+        if (e & 1)
+            r = prime_mulmod(r, a, m);
+        a = prime_mulmod(a, a, m);
+    }
+    return r;
+}
+
+/**
+ * Deterministic Miller-Rabin: the first 12 primes as bases are enough for
+ * every n below 3.3 * 10^24, so for every 64-bit n. Small n are settled by
+ * trial division by those same primes, which also keeps every base below n.
+ */
+static bool prime_miller_rabin(u64 n)
+{
+    static const u64 bases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    u64 d, x, rem;
+    unsigned int i, s, r;
+
+    for (i = 0; i < ARRAY_SIZE(bases); i++)
+    {
+        if (n == bases[i])
+            return true;
+        div64_u64_rem(n, bases[i], &rem);
+        if (rem == 0)
+            return false;
+    }
+    if (n < 41 * 41)
+        return n > 1;
+    for (d = n - 1, s = 0; (d & 1) == 0; d >>= 1, s++);
+    for (i = 0; i < ARRAY_SIZE(bases); i++)
+    {
+        x = prime_powmod(bases[i], d, n);
+        if ((x == 1) || (x == n - 1))
+            continue;
+        for (r = 1; (r < s) && (x != n - 1); r++)
+        {
+            x = prime_mulmod(x, x, n);
+        }
+        if (x != n - 1)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * PRIME_IOC_QUERY: values within the bitmap of the last finished sieve are
+ * looked up under `prime_dev_lock', which any bit below `prime_nbits' is
+ * final for, whatever the mode. A sieve still under way is not waited for,
+ * its values are tested like the others. PRIME_IOC_SIEVE holds the lock
+ * until its sieve is done, so the lock is only tried: when it is busy, every
+ * value is tested. Miller-Rabin runs once the lock is dropped, so that a
+ * long batch never holds up the device.
+ */
+static long prime_query(unsigned long arg)
+{
+    struct prime_query req;
+    u64 *nums;
+    u8 *res;
+    unsigned long i;
+    long ret = 0;
+
+    if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+        return -EFAULT;
+    if (req.count > PRIME_QUERY_MAX)
+        return -EINVAL;
+    nums = (u64 *)kmalloc_array(req.count, sizeof(u64), GFP_KERNEL);
+    res = (u8 *)kzalloc(req.count, GFP_KERNEL);
+    if ((nums == NULL) || (res == NULL))
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(nums, u64_to_user_ptr(req.nums), req.count * sizeof(u64)))
+    {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    req.sieved = 0;
+    if (mutex_trylock(&prime_dev_lock))
+    {
+        if (completion_done(&prime_done))
+            prime_finish();
+        for (i = 0; (prime_tasks == NULL) && (prime_works == NULL) && (prime_bits != NULL) && (i < req.count); i++)
+        {
+            if (nums[i] == 2)
+                res[i] = PRIME_QUERY_SIEVED | PRIME_QUERY_PRIME;
+            else if ((nums[i] < 3) || (nums[i] % 2 == 0))
+                res[i] = PRIME_QUERY_SIEVED;
+            else if (PRIME_BIT(nums[i]) < prime_nbits)
+                res[i] = PRIME_QUERY_SIEVED | (test_bit(PRIME_BIT(nums[i]), prime_bits) ? PRIME_QUERY_PRIME : 0);
+            req.sieved += !!(res[i] & PRIME_QUERY_SIEVED);
+        }
+        mutex_unlock(&prime_dev_lock);
+    }
+
+    for (i = 0; i < req.count; i++)
+    {
+        if (res[i] & PRIME_QUERY_SIEVED)
+            continue;
+        res[i] = prime_miller_rabin(nums[i]) ? PRIME_QUERY_PRIME : 0;
+        cond_resched();
+    }
+
+    if (copy_to_user(u64_to_user_ptr(req.results), res, req.count) ||
+        copy_to_user((void __user *)arg, &req, sizeof(req)))
+        ret = -EFAULT;
+out:
+    kfree(nums);
+    kfree(res);
+    return ret;
+}
+
+/**
+ * PRIME_IOC_SIEVE throws away the last sieve and runs a new one of
+ * [2, upper_bound], with the other module parameters as they are now. A higher
+ * bound extends the last sieve instead, whenever prime_extend() can.
+ * PRIME_IOC_INFO only describes the last sieve. Both wait until the sieve
+ * is done, and a sieve in range mode has no bitmap to describe. Count-only
+ * mode has a count but, past the bound it is checked at, no bitmap to map.
+ */
+static long prime_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct prime_sieve req;
+    struct prime_config cfg;
+    long ret;
+
+    if (cmd == PRIME_IOC_QUERY)
+        return prime_query(arg);
+    if ((cmd != PRIME_IOC_SIEVE) && (cmd != PRIME_IOC_INFO))
+        return -ENOTTY;
+    if (cmd == PRIME_IOC_SIEVE)
+    {
+        if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+            return -EFAULT;
+        if ((req.num_threads > PRIME_MAX_THREADS) || (req.upper_bound > ULONG_MAX))
+            return -EINVAL;
+    }
+
+    mutex_lock(&prime_dev_lock);
+    ret = prime_finish();
+    if ((ret == 0) && (cmd == PRIME_IOC_SIEVE))
+    {
+        prime_config_load(&cfg);
+        cfg.num_threads = req.num_threads;
+        cfg.lower_bound = 0;
+        cfg.upper_bound = req.upper_bound;
+        /* An invalid request leaves the last sieve alone, for INFO, mmap() and QUERY: */
+        if (prime_config_check(&cfg) != 0)
+        {
+            mutex_unlock(&prime_dev_lock);
+            return -EINVAL;
+        }
+        mutex_lock(&prime_stats_lock);
+        if ((prime_bits != NULL) && !prime_ranged && !prime_counting && (req.upper_bound > prime_cfg.upper_bound) &&
+            (int_sqrt(req.upper_bound) <= prime_cfg.upper_bound))
+            ret = prime_extend(&cfg);
+        else
+        {
+            prime_free();
+            prime_prev_cnt = 0;
+            ret = prime_start(&cfg, NULL, 0);
+        }
+        mutex_unlock(&prime_stats_lock);
+        if (ret == 0)
+            ret = prime_finish();
+    }
+    if ((ret == 0) && ((prime_bits == NULL) || prime_ranged))
+        ret = -ENODATA;
+    if (ret == 0)
+    {
+        req.upper_bound = prime_cfg.upper_bound;
+        req.num_threads = prime_cfg.num_threads;
+        req.num_primes = prime_counting ? prime_table_count() : prime_count();
+        req.map_bytes = (prime_counting && !prime_checking) ? 0 : BITS_TO_LONGS(prime_nbits) * sizeof(unsigned long);
+        req.sieved_from = prime_extending ? PRIME_NUM(prime_from) : 2;
+    }
+    mutex_unlock(&prime_dev_lock);
+
+    if ((ret == 0) && copy_to_user((void __user *)arg, &req, sizeof(req)))
+        ret = -EFAULT;
+    return ret;
+}
+
+/* Maps the bitmap of the last sieve read-only, without copying it: */
+static int prime_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    int ret;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    mutex_lock(&prime_dev_lock);
+    ret = prime_finish();
+    if ((ret == 0) && ((prime_bits == NULL) || prime_ranged || (prime_counting && !prime_checking)))
+        ret = -ENODATA;
+    if (ret == 0)
+        ret = remap_vmalloc_range(vma, prime_bits, vma->vm_pgoff);
+    mutex_unlock(&prime_dev_lock);
+    return ret;
+}
+
+/*
+ * The files of the debugfs directory `primes', one "key value" pair per
+ * line, or one line per thread. They can be read while the sieve runs:
+ * counters are then read as the threads update them, and phases still
+ * under way are timed up to the moment of reading.
+ */
+static int prime_params_show(struct seq_file *m, void *v)
+{
+    mutex_lock(&prime_stats_lock);
+    seq_printf(m, "num_threads %lu\n", prime_cfg.num_threads);
+    seq_printf(m, "upper_bound %lu\n", prime_cfg.upper_bound);
+    seq_printf(m, "lower_bound %lu\n", prime_cfg.lower_bound);
+    seq_printf(m, "sync %s\n", prime_sync_names[prime_sync]);
+    seq_printf(m, "segmented %d\n", prime_cfg.segmented);
+    seq_printf(m, "steal %d\n", prime_cfg.steal);
+    seq_printf(m, "workqueue %lu\n", prime_cfg.workqueue);
+    seq_printf(m, "segment_bits %lu\n", prime_seg_len);
+    seq_printf(m, "chunk_size %lu\n", prime_cfg.chunk_size);
+    seq_printf(m, "window_size %lu\n", prime_win_len);
+    seq_printf(m, "wheel %lu\n", prime_cfg.wheel);
+    seq_printf(m, "count_only %d\n", prime_cfg.count_only);
+    seq_printf(m, "spin_us %lu\n", prime_cfg.spin_us);
+    seq_printf(m, "pin_threads %d\n", prime_cfg.pin_threads);
+    seq_printf(m, "lock_stats %d\n", prime_cfg.lock_stats);
+    mutex_unlock(&prime_stats_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(prime_params);
+
+/* Stamps are read under `prime_stats_lock', so that they all belong to the same sieve: */
+static int prime_phases_show(struct seq_file *m, void *v)
+{
+    u64 now_ns, first_ns, second_ns;
+
+    mutex_lock(&prime_stats_lock);
+    now_ns = ktime_get_ns();
+    first_ns = READ_ONCE(prime_first_ns);
+    second_ns = READ_ONCE(prime_second_ns);
+    if (prime_stats == NULL)
+        seq_puts(m, "state idle\n");
+    else
+    {
+        seq_printf(m, "state %s\n", second_ns ? "done" : first_ns ? "running" : "setup");
+        seq_printf(m, "init_ns %llu\n", (first_ns ? first_ns : now_ns) - prime_init_ns);
+        seq_printf(m, "compute_ns %llu\n", first_ns ? (second_ns ? second_ns : now_ns) - first_ns : 0);
+        seq_printf(m, "total_ns %llu\n", (second_ns ? second_ns : now_ns) - prime_init_ns);
+    }
+    mutex_unlock(&prime_stats_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(prime_phases);
+
+static int prime_threads_show(struct seq_file *m, void *v)
+{
+    struct prime_stats *st;
+    unsigned long i;
+    u64 start_ns, finish_ns;
+
+    mutex_lock(&prime_stats_lock);
+    if (prime_stats != NULL)
+        seq_puts(m, "thread marks claims init_ns start_ns finish_ns wait_ns primes steals\n");
+    for (i = 0; (prime_stats != NULL) && (i < prime_cfg.num_threads); i++)
+    {
+        st = &prime_stats[i];
+        /* Times are relative to the start of the setup, 0 until reached: */
+        start_ns = READ_ONCE(st->start_ns);
+        finish_ns = READ_ONCE(st->finish_ns);
+        seq_printf(m, "%lu %lu %lu %llu %llu %llu %llu %lu %lu\n", i, READ_ONCE(st->marks), READ_ONCE(st->claims),
+                   READ_ONCE(st->init_ns), start_ns ? start_ns - prime_init_ns : 0,
+                   finish_ns ? finish_ns - prime_init_ns : 0, READ_ONCE(st->wait_ns), READ_ONCE(st->primes),
+                   READ_ONCE(st->steals));
+    }
+    mutex_unlock(&prime_stats_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(prime_threads);
+
+static int prime_counts_show(struct seq_file *m, void *v)
+{
+    bool done;
+
+    mutex_lock(&prime_stats_lock);
+    done = (READ_ONCE(prime_second_ns) != 0);
+    if (prime_stats != NULL)
+    {
+        seq_printf(m, "marks %lu\n", prime_marks());
+        /* Range mode counts each window as it goes, the bitmap only makes sense once done: */
+        if (prime_ranged)
+            seq_printf(m, "primes %lu\n", prime_range_count());
+        else if (done && prime_counting)
+            seq_printf(m, "primes %lu\n", prime_table_count());
+        else if (done)
+            seq_printf(m, "primes %lu\n", prime_count());
+    }
+    mutex_unlock(&prime_stats_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(prime_counts);
+
+/*
+ * The primes of the last sieve, for reading at memory bandwidth instead of
+ * through the kernel log, in two binary forms. Both are empty until a
+ * sieve of all of [2, upper_bound] is done, so in range mode, and in
+ * count-only mode past the bound it is checked at, they stay empty.
+ *
+ * `bitmap' is the bitmap itself, as mmap() of /dev/primes shows it: bit k
+ * of the native unsigned long words stands for 2k + 3. Any byte offset can
+ * be sought to directly.
+ *
+ * `deltas' is the sequence of the primes as unsigned LEB128 varints, each
+ * the gap to the previous prime, or the prime itself for 2: 7 bits per
+ * byte, least significant first, the top bit set on all bytes but the
+ * last. Nearly every gap below 2^32 fits in a byte or two. Each record
+ * covers PRIME_EXPORT_BITS bits of the bitmap, and sequential reads resume
+ * at the record they stopped in. Seeking replays the records before the
+ * offset, as with any seq_file, so random access is better done on `bitmap'.
+ */
+static bool prime_exportable(void)
+{
+    return (prime_stats != NULL) && (READ_ONCE(prime_second_ns) != 0) && (prime_bits != NULL) && !prime_ranged &&
+           !(prime_counting && !prime_checking);
+}
+
+/* Records of `deltas', at least one so that 2 shows up even with no odd integer in the bitmap: */
+static unsigned long prime_export_records(void)
+{
+    return max_t(unsigned long, DIV_ROUND_UP(prime_nbits, PRIME_EXPORT_BITS), 1);
+}
+
+static ssize_t prime_bitmap_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    ssize_t ret = 0;
+
+    mutex_lock(&prime_stats_lock);
+    if (prime_exportable())
+        ret = simple_read_from_buffer(buf, count, ppos, prime_bits,
+                                      BITS_TO_LONGS(prime_nbits) * sizeof(unsigned long));
+    mutex_unlock(&prime_stats_lock);
+    return ret;
+}
+
+static const struct file_operations prime_bitmap_fops = {
+    .owner = THIS_MODULE,
+    .read = prime_bitmap_read,
+    .llseek = default_llseek,
+};
+
+/* The bitmap cannot go away while `prime_stats_lock' is held, from start to stop: */
+static void *prime_deltas_start(struct seq_file *m, loff_t *pos)
+{
+    mutex_lock(&prime_stats_lock);
+    if (!prime_exportable() || (*pos >= prime_export_records()))
+        return NULL;
+    return pos;
+}
+
+static void *prime_deltas_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    ++*pos;
+    return (*pos < prime_export_records()) ? pos : NULL;
+}
+
+static void prime_deltas_stop(struct seq_file *m, void *v)
+{
+    mutex_unlock(&prime_stats_lock);
+}
+
+static void prime_put_varint(struct seq_file *m, unsigned long v)
+{
+    for (; v >= 0x80; v >>= 7)
+    {
+        seq_putc(m, (v & 0x7f) | 0x80);
+    }
+    seq_putc(m, v);
+}
+
+/* Emits the gaps of the primes within a record, the first one from the last prime before it: */
+static int prime_deltas_show(struct seq_file *m, void *v)
+{
+    unsigned long lo = *(loff_t *)v * PRIME_EXPORT_BITS;
+    unsigned long hi = min(lo + PRIME_EXPORT_BITS, prime_nbits);
+    unsigned long k, prev = 2;
+
+    if (lo == 0)
+        prime_put_varint(m, 2);
+    for (k = lo; k-- > 0;)
+    {
+        if (test_bit(k, prime_bits))
+        {
+            prev = PRIME_NUM(k);
+            break;
+        }
+    }
+    for (k = find_next_bit(prime_bits, hi, lo); k < hi; k = find_next_bit(prime_bits, hi, k + 1))
+    {
+        prime_put_varint(m, PRIME_NUM(k) - prev);
+        prev = PRIME_NUM(k);
+    }
+    return 0;
+}
+
+static const struct seq_operations prime_deltas_sops = {
+    .start = prime_deltas_start,
+    .next = prime_deltas_next,
+    .stop = prime_deltas_stop,
+    .show = prime_deltas_show,
+};
+
+static int prime_deltas_open(struct inode *inode, struct file *file)
+{
+    return seq_open(file, &prime_deltas_sops);
+}
+
+static const struct file_operations prime_deltas_fops = {
+    .owner = THIS_MODULE,
+    .open = prime_deltas_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = seq_release,
+};
+
+/* Creates the debugfs directory, whose absence only loses those files: */
+static void prime_debugfs_init(void)
+{
+    prime_dbg_dir = debugfs_create_dir("primes", NULL);
+    debugfs_create_file("params", 0444, prime_dbg_dir, NULL, &prime_params_fops);
+    debugfs_create_file("phases", 0444, prime_dbg_dir, NULL, &prime_phases_fops);
+    debugfs_create_file("threads", 0444, prime_dbg_dir, NULL, &prime_threads_fops);
+    debugfs_create_file("counts", 0444, prime_dbg_dir, NULL, &prime_counts_fops);
+    debugfs_create_file("bitmap", 0444, prime_dbg_dir, NULL, &prime_bitmap_fops);
+    debugfs_create_file("deltas", 0444, prime_dbg_dir, NULL, &prime_deltas_fops);
+}
+
+static const struct file_operations prime_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = prime_ioctl,
+    .mmap = prime_mmap,
+};
+
+static struct miscdevice prime_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "primes",
+    .fops = &prime_fops,
+};
+
+/**
+ * Registers /dev/primes and the debugfs directory `primes', then sieves
+ * once with the module parameters as before. The workqueues of workqueue
+ * mode are the module's own, as its items run CPU-bound for the whole
+ * sieve: on the shared system workqueues they would hold up all the other
+ * work queued there. Per-CPU items are marked CPU-intensive, so that they
+ * do not hold up other work items of their worker pool either.
+ */
+static int prime_init(void)
+{
+    struct prime_config cfg;
+    int ret;
+
+    printk(KERN_ALERT "Lab 2: Kernel Module Concurrent Memory Use\n");
+
+    prime_wq = alloc_workqueue("primes", WQ_UNBOUND, 0);
+    prime_percpu_wq = alloc_workqueue("primes_percpu", WQ_CPU_INTENSIVE, 0);
+    if ((prime_wq == NULL) || (prime_percpu_wq == NULL))
+    {
+        printk(KERN_ALERT "alloc_workqueue for primes failed!\n");
+        ret = -ENOMEM;
+        goto out_wq;
+    }
+
+    ret = misc_register(&prime_dev);
+    if (ret != 0)
+    {
+        printk(KERN_ALERT "misc_register for /dev/primes failed!\n");
+        goto out_wq;
+    }
+
+    prime_debugfs_init();
+    prime_prev_cnt = 0;
+    prime_config_load(&cfg);
+    mutex_lock(&prime_stats_lock);
+    ret = prime_start(&cfg, NULL, 0);
+    mutex_unlock(&prime_stats_lock);
+    if (ret == 0)
+        return 0;
+    debugfs_remove_recursive(prime_dbg_dir);
+    misc_deregister(&prime_dev);
+out_wq:
+    if (prime_percpu_wq != NULL)
+        destroy_workqueue(prime_percpu_wq);
+    if (prime_wq != NULL)
+        destroy_workqueue(prime_wq);
+    return ret;
+}
+
+static void prime_exit(void)
+{
+    debugfs_remove_recursive(prime_dbg_dir);
+    misc_deregister(&prime_dev);
+
+    /* Make sure every thread, or work item, has returned before the module goes away: */
+    if ((prime_tasks != NULL) || (prime_works != NULL))
+    {
+        if (!completion_done(&prime_done))
+            printk(KERN_ALERT "Processing not completed, waiting for the threads to finish...\n");
+        wait_for_completion(&prime_done);
+        prime_finish();
+    }
+
+    if (prime_bits != NULL)
+        prime_print();
+
+    /* Clean up the pointers after use: */
+    prime_free();
+    destroy_workqueue(prime_percpu_wq);
+    destroy_workqueue(prime_wq);
+
+    printk(KERN_ALERT "Out, out, brief candle!\n");
+    return;
+}
+
+module_init(prime_init);
+module_exit(prime_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("x.xingjian");
+MODULE_DESCRIPTION("CSE 422S Lab 2");
@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""
+Benchmark sweep of the Lab 2 sieve over a num_threads x upper_bound grid.
+
+Each configuration is run --reps times, either by loading primes.ko
+(insmod, then polling debugfs `primes/phases' until the sieve is done,
+then rmmod) or, with --user, by running the userspace build primes_user.
+The setup, computation and total times of every run are summarized as
+min, median, p95, stddev and mean, with the speedup of the median over
+the same configuration with 1 thread, and written as CSV and/or JSON.
+
+Every run of an upper_bound must find the same number of primes. With
+--baseline, medians are also compared against an earlier JSON output.
+Either kind of failure makes the exit status 1, so that regressions
+are caught by a script.
+
+Loading the module needs root and a mounted debugfs.
+Usage: sudo ./primes_bench.py --sync atomic,lockfree --threads 1,2,4 \\
+           --bounds 10^6,10^7,10^8 --reps 7 --csv out.csv --json out.json
+"""
+import argparse
+import csv
+import json
+import math
+import os
+import re
+import statistics
+import subprocess
+import sys
+import time
+
+PHASES = ("init", "compute", "total")
+# Lines of prime_print(), printed to stdout by primes_user:
+USER_TIMES = {
+    "init": r"Time spent on setting up the module: (\d+)\.(\d+) seconds",
+    "compute": r"Time spent on prime computation: (\d+)\.(\d+) seconds",
+    "total": r"Total time spent: (\d+)\.(\d+) seconds",
+}
+USER_PRIMES = r"There are (\d+) primes and"
+
+
+def parse_bound(s):
+    """Accepts 1000000, 1e6 or 10^6."""
+    if "^" in s:
+        base, exp = s.split("^")
+        return int(base) ** int(exp)
+    return int(float(s)) if "e" in s.lower() else int(s)
+
+
+def read_keys(path):
+    """Reads a debugfs file of `key value' lines."""
+    with open(path) as f:
+        return dict(line.split(None, 1) for line in f.read().splitlines() if " " in line)
+
+
+def run_module(args, params):
+    subprocess.run(["insmod", args.module] + params, check=True)
+    try:
+        deadline = time.monotonic() + args.timeout
+        while True:
+            phases = read_keys(os.path.join(args.debugfs, "phases"))
+            if phases.get("state", "").strip() == "done":
+                break
+            if time.monotonic() > deadline:
+                raise RuntimeError("timed out waiting for the sieve: " + " ".join(params))
+            time.sleep(0.01)
+        counts = read_keys(os.path.join(args.debugfs, "counts"))
+        times = {p: int(phases[p + "_ns"]) / 1e9 for p in PHASES}
+        return times, int(counts["primes"]) if "primes" in counts else None
+    finally:
+        subprocess.run(["rmmod", os.path.splitext(os.path.basename(args.module))[0]], check=True)
+
+
+def run_user(args, params):
+    out = subprocess.run([args.user] + params, check=True, stdout=subprocess.PIPE,
+                         universal_newlines=True, timeout=args.timeout).stdout
+    times = {}
+    for p, pattern in USER_TIMES.items():
+        m = re.search(pattern, out)
+        times[p] = int(m.group(1)) + int(m.group(2)) / 1e9
+    m = re.search(USER_PRIMES, out)
+    return times, int(m.group(1)) if m else None
+
+
+def percentile(xs, q):
+    """Nearest-rank percentile of the sorted list xs."""
+    return xs[max(0, math.ceil(q / 100 * len(xs)) - 1)]
+
+
+def summarize(xs):
+    xs = sorted(xs)
+    return {
+        "min": xs[0],
+        "median": statistics.median(xs),
+        "p95": percentile(xs, 95),
+        "stddev": statistics.stdev(xs) if len(xs) > 1 else 0.0,
+        "mean": statistics.mean(xs),
+    }
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--module", default="./primes.ko", help="module to load (default ./primes.ko)")
+    ap.add_argument("--user", metavar="PATH", help="run this primes_user binary instead of loading the module")
+    ap.add_argument("--debugfs", default="/sys/kernel/debug/primes", help="debugfs directory of the module")
+    ap.add_argument("--sync", default="atomic", help="comma-separated sync strategies (default atomic)")
+    ap.add_argument("--threads", default="1,2,4", help="comma-separated num_threads (default 1,2,4)")
+    ap.add_argument("--bounds", default="10^6,10^7", help="comma-separated upper_bound, e.g. 10^8 or 1e8")
+    ap.add_argument("--reps", type=int, default=7, help="runs per configuration (default 7)")
+    ap.add_argument("--param", action="append", default=[], metavar="NAME=VALUE",
+                    help="further module parameter, may be repeated, e.g. --param segmented=1")
+    ap.add_argument("--timeout", type=float, default=600, help="seconds allowed per run (default 600)")
+    ap.add_argument("--csv", metavar="PATH", help="write the summary as CSV")
+    ap.add_argument("--json", metavar="PATH", help="write the summary, and every run, as JSON")
+    ap.add_argument("--baseline", metavar="PATH", help="JSON output of an earlier sweep to compare medians against")
+    ap.add_argument("--tolerance", type=float, default=10, help="percent a median may exceed the baseline by (default 10)")
+    args = ap.parse_args()
+
+    syncs = args.sync.split(",")
+    threads = sorted(int(t) for t in args.threads.split(","))
+    bounds = [parse_bound(b) for b in args.bounds.split(",")]
+    run = run_user if args.user else run_module
+    failed = False
+
+    results = []
+    primes_of = {}
+    for sync in syncs:
+        for bound in bounds:
+            for t in threads:
+                params = ["num_threads=%d" % t, "upper_bound=%d" % bound, "sync=" + sync] + args.param
+                runs = []
+                for rep in range(args.reps):
+                    times, primes = run(args, params)
+                    runs.append(times)
+                    # Every strategy and thread count must agree on the count:
+                    if primes is not None and primes_of.setdefault(bound, primes) != primes:
+                        print("MISMATCH: %s found %d primes, expected %d" % (" ".join(params), primes, primes_of[bound]),
+                              file=sys.stderr)
+                        failed = True
+                row = {"sync": sync, "num_threads": t, "upper_bound": bound, "reps": args.reps,
+                       "primes": primes_of.get(bound), "runs": runs}
+                for p in PHASES:
+                    row[p] = summarize([r[p] for r in runs])
+                results.append(row)
+                print("%-11s num_threads=%-3d upper_bound=%-12d compute median %.6f s, total median %.6f s"
+                      % (sync, t, bound, row["compute"]["median"], row["total"]["median"]), file=sys.stderr)
+
+    # Speedup of the median over 1 thread, or over the fewest threads swept:
+    for row in results:
+        base = next(r for r in results if r["sync"] == row["sync"] and r["upper_bound"] == row["upper_bound"]
+                    and r["num_threads"] == threads[0])
+        for p in PHASES:
+            row[p]["speedup"] = base[p]["median"] / row[p]["median"] if row[p]["median"] > 0 else None
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            old_sweep = json.load(f)
+        # Only sweeps of the same further parameters and backend are comparable, the results are written anyway:
+        comparable = (old_sweep["params"], old_sweep["backend"]) == (args.param, "user" if args.user else "module")
+        if not comparable:
+            print("Baseline ran with %s on the %s backend, not comparable" % (old_sweep["params"], old_sweep["backend"]),
+                  file=sys.stderr)
+            failed = True
+        baseline = {(r["sync"], r["num_threads"], r["upper_bound"]): r for r in old_sweep["results"]} if comparable else {}
+        for row in results:
+            old = baseline.get((row["sync"], row["num_threads"], row["upper_bound"]))
+            if old is None:
+                continue
+            for p in ("compute", "total"):
+                if row[p]["median"] > old[p]["median"] * (1 + args.tolerance / 100):
+                    print("REGRESSION: %s num_threads=%d upper_bound=%d %s median %.6f s, was %.6f s"
+                          % (row["sync"], row["num_threads"], row["upper_bound"], p, row[p]["median"],
+                             old[p]["median"]), file=sys.stderr)
+                    failed = True
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            w = csv.writer(f)
+            w.writerow(["sync", "num_threads", "upper_bound", "primes", "phase", "reps",
+                        "min_s", "median_s", "p95_s", "stddev_s", "mean_s", "speedup"])
+            for row in results:
+                for p in PHASES:
+                    s = row[p]
+                    w.writerow([row["sync"], row["num_threads"], row["upper_bound"], row["primes"], p, row["reps"],
+                                "%.9f" % s["min"], "%.9f" % s["median"], "%.9f" % s["p95"], "%.9f" % s["stddev"],
+                                "%.9f" % s["mean"], "%.3f" % s["speedup"] if s["speedup"] is not None else ""])
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"params": args.param, "backend": "user" if args.user else "module", "results": results},
+                      f, indent=1)
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,1530 @@
+/*
+ * The sieve engine shared by the module, primes.c, and its userspace build,
+ * primes_user.c: the strategies, the barrier, the modes, the statistics and
+ * their printing, and the setup of a sieve up to the point where its threads
+ * can run. It is only ever included by those two files, after the headers,
+ * or the stand-ins for them, that provide the kernel interfaces it uses:
+ * bitops, spin locks, mutexes, wait queues, atomics, completions, static
+ * keys, allocators and ktime_get_ns(). Each of them defines how the bitmap
+ * is allocated and freed, see prime_alloc_bits() and prime_free_bits(), and
+ * how the threads, or work items, are spawned.
+ */
+#ifndef PRIMES_ENGINE_H
+#define PRIMES_ENGINE_H
+
+/* Default segment footprint for the segmented sieve, roughly one L2 cache: */
+#define PRIME_SEGMENT_BYTES (256 * 1024)
+/* Segments each thread starts with in work-stealing mode, so that there is something to steal: */
+#define PRIME_STEAL_SEGMENTS 8
+/* Only odd integers are stored, bit k of the sieve stands for 2k + 3: */
+#define PRIME_BIT(n) (((n) - 3) / 2)
+#define PRIME_NUM(k) (2 * (k) + 3)
+/* Rounds of the dissemination barrier, which bounds num_threads: */
+#define PRIME_BAR_ROUNDS 16
+#define PRIME_MAX_THREADS (1UL << PRIME_BAR_ROUNDS)
+/* Bounds up to which count-only mode still sieves, to check the count against: */
+#define PRIME_COUNT_CHECK_MAX (1UL << 24)
+/* Table entries per thread below which a round of the count is left to one thread: */
+#define PRIME_COUNT_MIN_ENTRIES 256
+
+/*
+ * How threads claim base primes and cross out their multiples, as named
+ * by the `sync' parameter:
+ *   spinlock    - claim under `prime_lock_1', clear under `prime_lock_2';
+ *   atomic      - claim under `prime_lock_1', clear with atomic bit operations;
+ *   partitioned - each thread owns a range of the bitmap and uses plain stores;
+ *   mutex       - claim under `prime_mutex_1', clear under `prime_mutex_2';
+ *   lockfree    - claim with an atomic fetch-add, clear with atomic bit operations.
+ */
+enum prime_sync {
+    PRIME_SYNC_SPINLOCK,
+    PRIME_SYNC_ATOMIC,
+    PRIME_SYNC_PARTITIONED,
+    PRIME_SYNC_MUTEX,
+    PRIME_SYNC_LOCKFREE,
+};
+
+static const char *const prime_sync_names[] = {
+    [PRIME_SYNC_SPINLOCK] = "spinlock",
+    [PRIME_SYNC_ATOMIC] = "atomic",
+    [PRIME_SYNC_PARTITIONED] = "partitioned",
+    [PRIME_SYNC_MUTEX] = "mutex",
+    [PRIME_SYNC_LOCKFREE] = "lockfree",
+};
+
+/*
+ * Locks watched when `lock_stats' is set: the one guarding claims, the one
+ * guarding crossing out, and the rounds of the barrier, which has no lock
+ * but is waited on all the same. Wait and hold times go into buckets of
+ * powers of two nanoseconds, bucket b counting those within [2^(b-1), 2^b).
+ */
+enum prime_lock_id {
+    PRIME_LOCK_CLAIM,
+    PRIME_LOCK_MARK,
+    PRIME_LOCK_BAR,
+    PRIME_NLOCKS,
+};
+#define PRIME_HIST_BUCKETS 32
+
+struct prime_lock_stats {
+    unsigned long acquired;  /* Times the lock was taken, or a round waited on */
+    unsigned long contended; /* Of which the lock was held, or the partner late */
+    unsigned long wait_hist[PRIME_HIST_BUCKETS];
+    unsigned long hold_hist[PRIME_HIST_BUCKETS];
+};
+
+/**
+ * Per-thread state of the dissemination barrier. A thread only ever spins
+ * on the flags inside its own node, and nodes are cache-line aligned, so
+ * no two threads spin on the same line. Once it has spun long enough, the
+ * thread sleeps on its own wait queue instead.
+ */
+struct prime_bar_node {
+    /* Set by the partner of each round, one set of flags per parity: */
+    unsigned int flags[2][PRIME_BAR_ROUNDS];
+    unsigned int parity;
+    unsigned int sense;
+    wait_queue_head_t wq;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Deque of the segments left to a thread in work-stealing mode, which are
+ * always the consecutive segments within [head, tail). The owner takes
+ * them one at a time from the head, in order, and thieves take half of
+ * them at once from the tail. Deques are cache-line aligned, so that a
+ * thread only touches the line of another one while stealing from it.
+ */
+struct prime_deque {
+    spinlock_t lock;
+    unsigned long head;
+    unsigned long tail;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Per-thread statistics. Each thread only ever writes to its own block,
+ * and blocks are cache-line aligned, so that threads never invalidate each
+ * other's lines while crossing out.
+ */
+struct prime_stats {
+    unsigned long marks;  /* Numbers crossed out */
+    unsigned long claims; /* Base primes, or segments, claimed */
+    unsigned long steals; /* Times it stole segments in work-stealing mode */
+    u64 start_ns;         /* Leaving the first barrier */
+    u64 finish_ns;        /* Arriving at the second barrier */
+    u64 init_ns;          /* Spent setting up its slice of the bitmap */
+    u64 wait_ns;          /* Spent waiting in the barriers */
+    unsigned long primes; /* Primes found in the windows of range mode */
+    unsigned long updates; /* Table entries updated in count-only mode */
+    struct prime_lock_stats locks[PRIME_NLOCKS]; /* Only kept when `lock_stats' is set */
+} ____cacheline_aligned_in_smp;
+
+/**
+ * The module parameters a sieve runs with, see their definitions in primes.c.
+ * Parameters stay writable through sysfs while the module is loaded, so a
+ * sieve takes a copy of them when it starts and never reads them again.
+ */
+struct prime_config {
+    unsigned long num_threads;
+    unsigned long upper_bound;
+    unsigned long lower_bound;
+    int sync; /* Index into `prime_sync_names', or -EINVAL */
+    bool segmented;
+    unsigned long segment_size;
+    bool steal;
+    unsigned long workqueue;
+    unsigned long chunk_size;
+    unsigned long spin_us;
+    bool lock_stats;
+    bool pin_threads;
+    unsigned long window_size;
+    bool print_primes;
+    bool count_only;
+    unsigned long wheel;
+};
+
+/* Work items of workqueue mode still running: */
+static atomic_t prime_pending;
+/* CPU each thread is bound to when `pin_threads' is set: */
+static unsigned int *prime_cpu;
+/* Time stamps in nanoseconds: setup started, all threads set up, all threads done: */
+static u64 prime_init_ns, prime_first_ns, prime_second_ns;
+
+/* Keeps track of how many times each thread has "crossed out" a non-prime number, and more: */
+static struct prime_stats *prime_stats;
+/* Range within which primes will be computed, one bit per odd integer: */
+static unsigned long *prime_bits;
+static unsigned long prime_nbits;
+/* Pages mapped behind `prime_bits' by the module, see prime_alloc_bits(): */
+static struct page **prime_pages;
+static unsigned long prime_npages;
+/* Bits standing for the odd integers within [3, sqrt(upper_bound)]: */
+static unsigned long prime_nroot;
+/* Odd base primes within [3, sqrt(upper_bound)] used by the segmented sieve: */
+static unsigned long *prime_base;
+static unsigned long prime_nbase;
+/* Crossing out performed before any thread runs, by the wheel and for the base primes: */
+static unsigned long prime_base_cnt;
+/* First bit left to cross out after the wheel, 0 without a wheel, and the wheel pattern and its words: */
+static unsigned long prime_wheel_from;
+static unsigned long *prime_wheel_pattern;
+static unsigned long prime_wheel_len;
+/* Words of the bitmap set up before the threads run, the threads set up the rest: */
+static unsigned long prime_fill_from;
+/* First bit the threads sieve with the base primes, past what is already sieved: */
+static unsigned long prime_from;
+/* Whether the sieve extends an earlier one, and the crossing out that one took: */
+static bool prime_extending;
+static unsigned long prime_prev_cnt;
+/* Whether the sieve runs in range mode, and the window buffer of each thread: */
+static bool prime_ranged;
+static unsigned long **prime_win;
+static unsigned long prime_win_len;
+/* Whether segments are handed out through deques, the deques, and the number of segments: */
+static bool prime_stealing;
+static struct prime_deque *prime_deques;
+static unsigned long prime_nsegs;
+/* Whether the sieve runs on work items rather than on threads of its own: */
+static bool prime_queued;
+/* Count-only mode, and whether [2, upper_bound] is still sieved to check it: */
+static bool prime_counting;
+static bool prime_checking;
+/*
+ * Table of count-only mode, S(upper_bound / i) then S(i) for each i within
+ * [1, prime_count_root], followed by the changes of the round under way.
+ */
+static unsigned long *prime_table;
+static unsigned long prime_count_root;
+/* Number of bits per segment: */
+static unsigned long prime_seg_len;
+/* Current position that is being processed: */
+volatile unsigned long prime_pos;
+/* Next bit (or segment) to be claimed by a fetch-add in lock-free mode: */
+static atomic_long_t prime_claim;
+/* Completed once all threads have finished the computation of prime numbers: */
+static DECLARE_COMPLETION(prime_done);
+/* Barrier nodes of the threads, and rounds needed for num_threads: */
+static struct prime_bar_node *prime_bar;
+static unsigned int prime_bar_rounds;
+/* Statically initialize the locks, `_1' guards claiming and `_2' crossing out: */
+static DEFINE_SPINLOCK(prime_lock_1);
+static DEFINE_SPINLOCK(prime_lock_2);
+static DEFINE_MUTEX(prime_mutex_1);
+static DEFINE_MUTEX(prime_mutex_2);
+/* Parameters of the sieve under way, or of the last one, and its strategy: */
+static struct prime_config prime_cfg;
+static enum prime_sync prime_sync;
+/* Enabled while `lock_stats' is set, so that locks cost nothing extra otherwise: */
+static DEFINE_STATIC_KEY_FALSE(prime_lock_stats_on);
+/* Odd primes a wheel may be made of, and the one after the largest wheel: */
+static const unsigned long prime_wheel_primes[] = {3, 5, 7, 11, 13};
+
+/**
+ * Defined by the includer: allocates the `words' words of the bitmap and a
+ * spare one, setting `prime_pages' and `prime_npages' if it maps pages, and
+ * clears the spare word and anything else past the bitmap that can be seen.
+ * The bitmap itself is set up by prime_fill().
+ */
+static unsigned long *prime_alloc_bits(unsigned long words);
+/* Defined by the includer: frees a bitmap of prime_alloc_bits(), with its pages if any: */
+static void prime_free_bits(unsigned long *bits, struct page **pages, unsigned long npages);
+
+/* Bucket of the lock histograms that `ns' falls into: */
+static inline unsigned int prime_hist_bucket(u64 ns)
+{
+    return min(fls64(ns), PRIME_HIST_BUCKETS - 1);
+}
+
+/**
+ * Takes the lock `l' of the strategy `sync', a mutex with sync=mutex and a
+ * spin lock otherwise. When lock statistics are on, the lock is tried
+ * first so that contention is noticed, and the time it was acquired is
+ * returned for prime_unlock(); otherwise this is the bare lock.
+ */
+static __always_inline u64 prime_lock(struct prime_stats *st, const enum prime_lock_id l,
+                                      const enum prime_sync sync)
+{
+    struct prime_lock_stats *ls = &st->locks[l];
+    struct mutex *m = (l == PRIME_LOCK_CLAIM) ? &prime_mutex_1 : &prime_mutex_2;
+    spinlock_t *s = (l == PRIME_LOCK_CLAIM) ? &prime_lock_1 : &prime_lock_2;
+    u64 start_ns, now_ns;
+    bool got;
+
+    if (!static_branch_unlikely(&prime_lock_stats_on)) {
+        if (sync == PRIME_SYNC_MUTEX)
+            mutex_lock(m);
+        else
+            spin_lock(s);
+        return 0;
+    }
+    start_ns = ktime_get_ns();
+    got = (sync == PRIME_SYNC_MUTEX) ? mutex_trylock(m) : spin_trylock(s);
+    if (!got) {
+        if (sync == PRIME_SYNC_MUTEX)
+            mutex_lock(m);
+        else
+            spin_lock(s);
+        ls->contended++;
+    }
+    now_ns = ktime_get_ns();
+    ls->acquired++;
+    ls->wait_hist[prime_hist_bucket(now_ns - start_ns)]++;
+    return now_ns;
+}
+
+/* Releases what prime_lock() took at `locked_ns', counting how long it was held: */
+static __always_inline void prime_unlock(struct prime_stats *st, const enum prime_lock_id l,
+                                         const enum prime_sync sync, u64 locked_ns)
+{
+    if (static_branch_unlikely(&prime_lock_stats_on))
+        st->locks[l].hold_hist[prime_hist_bucket(ktime_get_ns() - locked_ns)]++;
+    if (sync == PRIME_SYNC_MUTEX)
+        mutex_unlock((l == PRIME_LOCK_CLAIM) ? &prime_mutex_1 : &prime_mutex_2);
+    else
+        spin_unlock((l == PRIME_LOCK_CLAIM) ? &prime_lock_1 : &prime_lock_2);
+}
+
+/**
+ * Clears bit i of `bits' the way `sync' says, on behalf of the thread
+ * whose statistics are `st'. `sync' is always a constant, so the switch
+ * folds away and each caller gets a loop of its own, with no dispatch
+ * left inside it.
+ */
+static __always_inline void prime_clear(unsigned long i, unsigned long *bits, struct prime_stats *st,
+                                        const enum prime_sync sync)
+{
+    u64 locked_ns;
+
+    switch (sync) {
+    case PRIME_SYNC_SPINLOCK:
+    case PRIME_SYNC_MUTEX:
+        locked_ns = prime_lock(st, PRIME_LOCK_MARK, sync);
+        __clear_bit(i, bits);
+        prime_unlock(st, PRIME_LOCK_MARK, sync, locked_ns);
+        break;
+    case PRIME_SYNC_PARTITIONED:
+        __clear_bit(i, bits);
+        break;
+    default:
+        clear_bit(i, bits);
+    }
+}
+
+/**
+ * Clears the odd multiples of the prime p standing for bit k of the
+ * bitmap with prime_clear(), starting at p * p since smaller multiples
+ * have a smaller prime factor, and adds the number crossed out to the
+ * statistics `st' of the calling thread.
+ */
+static __always_inline void mark_multiples(unsigned long k, struct prime_stats *st, const enum prime_sync sync)
+{
+    unsigned long i, cnt = 0;
+    unsigned long p = PRIME_NUM(k);
+
+    trace_prime_claim(st - prime_stats, p);
+    for (i = PRIME_BIT(p * p); i < prime_nbits; i += p) {
+        prime_clear(i, prime_bits, st, sync);
+        cnt++;
+    }
+    st->marks += cnt;
+    st->claims++;
+}
+
+/**
+ * The critical section.
+ * (a) Safely stores the value of the global position variable `i_pos' in
+ *     a local variable, and then advance the global position variable to
+ *     the next bit still set below `prime_nroot', or to `prime_nroot';
+ * (b) If the position in the local variable has reached `prime_nroot',
+ *     then the function should simply return, as every composite number
+ *     up to upper_bound has a prime factor no greater than its square
+ *     root; otherwise
+ * (c) Cross out each odd multiple of the local position variable with
+ *     mark_multiples(). Multiples of 2 are never stored, so crossing them
+ *     out is skipped.
+ * The global position is guarded by `prime_mutex_1' with sync=mutex, and
+ * by `prime_lock_1' otherwise, both taken through prime_lock().
+ */
+static __always_inline void select_and_mark(struct prime_stats *st, const enum prime_sync sync)
+{
+    unsigned long local_pos; /* Local position variable */
+    u64 locked_ns;
+
+    while (1) {
+        /* 
+         * Safely store the value of the global position variable in a
+         * local variable and then advance the global position variable:
+         */
+        locked_ns = prime_lock(st, PRIME_LOCK_CLAIM, sync);
+        local_pos = prime_pos;
+        if (prime_pos < prime_nroot)
+            prime_pos = find_next_bit(prime_bits, prime_nroot, prime_pos + 1);
+        prime_unlock(st, PRIME_LOCK_CLAIM, sync, locked_ns);
+
+        /* 
+         * If the value corresponding to the local position variable
+         * is greater than sqrt(upper_bound), then the function should
+         * simply return:
+         */
+        if (local_pos >= prime_nroot) break;
+        else mark_multiples(local_pos, st, sync);
+    }
+
+    return;
+}
+
+/**
+ * The lock-free counterpart of select_and_mark(). Instead of reading and
+ * advancing `prime_pos' under `prime_lock_1', each thread claims the next
+ * `chunk_size' bits below `prime_nroot' with a single atomic fetch-add,
+ * and then crosses out the multiples of every bit still set in its chunk.
+ * A bit may still be claimed before one of its factors clears it, which
+ * only costs some unnecessary crossing out, as with `prime_pos'.
+ */
+static void select_and_mark_lockfree(struct prime_stats *st)
+{
+    unsigned long k, lo, hi;
+
+    while ((lo = prime_wheel_from + atomic_long_fetch_add(prime_cfg.chunk_size, &prime_claim)) < prime_nroot) {
+        hi = min(lo + prime_cfg.chunk_size, prime_nroot);
+        for (k = find_next_bit(prime_bits, hi, lo); k < hi;
+             k = find_next_bit(prime_bits, hi, k + 1)) {
+            mark_multiples(k, st, PRIME_SYNC_LOCKFREE);
+        }
+    }
+}
+
+/**
+ * Crosses out the odd multiples of every base prime within the bits
+ * [lo, hi) of the bitmap `bits', whose first word stands for bit `off'
+ * of the whole sieve. Crossing out starts at the first odd multiple
+ * inside the segment, but never below p * p, as smaller multiples have a
+ * smaller prime factor. That multiple is found as an offset from the
+ * start of the segment, which never overflows, even for a window of range
+ * mode ending right below ULONG_MAX. The segment belongs to the calling thread alone,
+ * so `prime_lock_1' is never taken, and bits are cleared with
+ * prime_clear(). Callers that own every word of the segment pass
+ * PRIME_SYNC_PARTITIONED, so that bits are cleared with plain stores.
+ */
+static __always_inline void __mark_segment(unsigned long *bits, unsigned long off,
+                                           unsigned long lo, unsigned long hi,
+                                           struct prime_stats *st, const enum prime_sync sync)
+{
+    unsigned long i, j, p, d, cnt = 0;
+
+    trace_prime_segment_start(st - prime_stats, PRIME_NUM(lo), PRIME_NUM(hi - 1));
+    for (j = 0; j < prime_nbase; j++) {
+        p = prime_base[j];
+        /* PRIME_NUM(lo) + d is the first multiple of p, and odd, as is p: */
+        d = PRIME_NUM(lo) % p;
+        d = d ? p - d : 0;
+        if (d % 2)
+            d += p;
+        for (i = max(lo + d / 2, PRIME_BIT(p * p)); i < hi; i += p) {
+            prime_clear(i - off, bits, st, sync);
+            cnt++;
+        }
+    }
+    st->marks += cnt;
+    st->claims++;
+    trace_prime_segment_end(st - prime_stats, PRIME_NUM(lo), cnt);
+}
+
+/**
+ * The segmented counterpart of select_and_mark(). The bits past the
+ * base primes are cut into segments of `prime_seg_len' and the k-th thread
+ * sieves segments k, k + num_threads, k + 2 * num_threads, ... on its own,
+ * so that each pass over a segment stays within the cache and no thread
+ * ever reads or advances `prime_pos'. With sync=lockfree, segments are
+ * instead claimed one at a time with an atomic fetch-add on `prime_claim'.
+ * Segments are laid out on word boundaries, so no two threads ever write
+ * to the same word, but bits are still cleared as `sync' says, so that
+ * strategies can be compared on this path too. This is also how an earlier
+ * sieve is extended, whatever the mode, starting from `prime_from'.
+ */
+static __always_inline void select_and_mark_segmented(struct prime_stats *st, const enum prime_sync sync)
+{
+    unsigned long id = st - prime_stats; /* Index of the calling thread */
+    unsigned long first = round_down(prime_from, BITS_PER_LONG);
+    unsigned long seg, lo;
+
+    seg = (sync == PRIME_SYNC_LOCKFREE) ? atomic_long_fetch_add(1, &prime_claim) : id;
+    while (seg < prime_nsegs) {
+        lo = first + seg * prime_seg_len;
+        __mark_segment(prime_bits, 0, max(lo, prime_from), min(lo + prime_seg_len, prime_nbits), st, sync);
+        seg = (sync == PRIME_SYNC_LOCKFREE) ? atomic_long_fetch_add(1, &prime_claim) : seg + prime_cfg.num_threads;
+    }
+}
+
+/* Takes the segment at the head of the deque of thread `id', if any is left: */
+static bool prime_deque_pop(unsigned long id, unsigned long *seg)
+{
+    struct prime_deque *dq = &prime_deques[id];
+    bool got;
+
+    spin_lock(&dq->lock);
+    got = (dq->head < dq->tail);
+    if (got)
+        *seg = dq->head++;
+    spin_unlock(&dq->lock);
+    return got;
+}
+
+/**
+ * Moves half of the segments left in the deque of another thread, rounded
+ * up, to the empty deque of the calling thread `id'. Victims are tried in
+ * turn starting from a random one, so that thieves spread out over them.
+ * Returns false once every other deque is found empty: the only segments
+ * possibly left are then being moved by other thieves, who sieve them.
+ */
+static bool prime_steal(unsigned long id, struct prime_stats *st)
+{
+    struct prime_deque *dq;
+    unsigned long i, v = id, lo = 0, hi = 0;
+    unsigned long start = prandom_u32_max(prime_cfg.num_threads);
+
+    for (i = 0; (i < prime_cfg.num_threads) && (lo == hi); i++)
+    {
+        v = (start + i) % prime_cfg.num_threads;
+        dq = &prime_deques[v];
+        /* Empty deques are skipped without taking their lock: */
+        if ((v == id) || (READ_ONCE(dq->head) >= READ_ONCE(dq->tail)))
+            continue;
+        spin_lock(&dq->lock);
+        hi = dq->tail;
+        lo = hi - (dq->tail - min(dq->head, dq->tail) + 1) / 2;
+        dq->tail = lo;
+        spin_unlock(&dq->lock);
+    }
+    if (lo == hi)
+        return false;
+
+    dq = &prime_deques[id];
+    spin_lock(&dq->lock);
+    dq->head = lo;
+    dq->tail = hi;
+    spin_unlock(&dq->lock);
+    st->steals++;
+    trace_prime_steal(id, v, hi - lo);
+    return true;
+}
+
+/**
+ * The work-stealing counterpart of select_and_mark(). Segments are laid
+ * out as in select_and_mark_segmented(), and the k-th thread starts with
+ * the k-th run of `prime_nsegs / num_threads' of them in its deque. Once
+ * its deque is empty, it steals half of what is left in another one, so
+ * that threads finishing early take over from the stragglers. Bits are
+ * cleared as `sync' says.
+ */
+static __always_inline void select_and_mark_stealing(struct prime_stats *st, const enum prime_sync sync)
+{
+    unsigned long id = st - prime_stats; /* Index of the calling thread */
+    unsigned long first = round_down(prime_from, BITS_PER_LONG);
+    unsigned long seg, lo;
+
+    while (1) {
+        if (!prime_deque_pop(id, &seg)) {
+            if (!prime_steal(id, st))
+                break;
+            continue;
+        }
+        lo = first + seg * prime_seg_len;
+        __mark_segment(prime_bits, 0, max(lo, prime_from), min(lo + prime_seg_len, prime_nbits), st, sync);
+    }
+}
+
+/* Bits per range with sync=partitioned, a whole number of words and never 0: */
+static unsigned long prime_part_len(void)
+{
+    unsigned long first = round_down(prime_from, BITS_PER_LONG);
+
+    return max_t(unsigned long, round_up(DIV_ROUND_UP(prime_nbits - first, prime_cfg.num_threads), BITS_PER_LONG),
+                 BITS_PER_LONG);
+}
+
+/**
+ * The ownership-partitioned counterpart of select_and_mark(). The bits past
+ * the base primes are split into `num_threads' contiguous ranges of whole
+ * words, and the k-th thread crosses out the k-th range alone, one segment
+ * of `prime_seg_len' at a time. No other thread ever writes to those words,
+ * so crossing out uses plain stores, with neither a lock nor an atomic
+ * operation. The second barrier makes them visible to everyone else.
+ */
+static void select_and_mark_partitioned(struct prime_stats *st)
+{
+    unsigned long id = st - prime_stats; /* Index of the calling thread */
+    unsigned long first = round_down(prime_from, BITS_PER_LONG);
+    unsigned long len = prime_part_len();
+    unsigned long lo = first + id * len;
+    unsigned long end = min(lo + len, prime_nbits);
+
+    for (; lo < end; lo += prime_seg_len) {
+        __mark_segment(prime_bits, 0, max(lo, prime_from), min(lo + prime_seg_len, end), st, PRIME_SYNC_PARTITIONED);
+    }
+}
+
+/**
+ * The range mode counterpart of select_and_mark(). The odd integers within
+ * [lower_bound, upper_bound] are cut into windows of `prime_win_len', and
+ * the k-th thread sieves windows k, k + num_threads, ... in turn, within
+ * its own buffer and with plain stores. Each window is counted, and printed
+ * if asked to, before the buffer is reused for the next one, so memory
+ * never grows with the range. Windows finish out of order across threads.
+ */
+static void select_and_mark_range(struct prime_stats *st)
+{
+    unsigned long id = st - prime_stats; /* Index of the calling thread */
+    unsigned long *buf = prime_win[id];
+    unsigned long first = PRIME_BIT(max(prime_cfg.lower_bound, 3UL) | 1);
+    unsigned long end = (prime_cfg.upper_bound - 1) / 2; /* Past the last odd integer in range */
+    unsigned long nwins = DIV_ROUND_UP(end - first, prime_win_len);
+    unsigned long w, lo, hi, k, cnt;
+
+    /* 2 is in no window, but counts when in range, see prime_range_count(): */
+    if ((id == 0) && prime_cfg.print_primes && (prime_cfg.lower_bound <= 2))
+        printk(KERN_INFO "2\n");
+    for (w = id; w < nwins; w += prime_cfg.num_threads) {
+        lo = first + w * prime_win_len;
+        hi = min(lo + prime_win_len, end);
+        bitmap_fill(buf, hi - lo);
+        __mark_segment(buf, lo, lo, hi, st, PRIME_SYNC_PARTITIONED);
+        cnt = bitmap_weight(buf, hi - lo);
+        st->primes += cnt;
+        printk(KERN_INFO "There are %lu primes within [%lu, %lu].\n", cnt, PRIME_NUM(lo), PRIME_NUM(hi - 1));
+        if (!prime_cfg.print_primes)
+            continue;
+        for_each_set_bit(k, buf, hi - lo) {
+            printk(KERN_INFO "%lu\n", PRIME_NUM(lo + k));
+        }
+    }
+}
+
+/**
+ * Serially sieves the prefix of the bitmap standing for [3, sqrt(upper_bound)],
+ * before any thread is spawned. When extending an earlier sieve, the prefix
+ * is already sieved.
+ */
+static void prime_sieve_root(void)
+{
+    unsigned long i, j, p;
+    unsigned long root = int_sqrt(prime_cfg.upper_bound);
+
+    /* The primes of the wheel are crossed out already: */
+    for (i = prime_wheel_from; !prime_extending && (PRIME_NUM(i) * PRIME_NUM(i) <= root); i++)
+    {
+        if (!test_bit(i, prime_bits))
+            continue;
+        p = PRIME_NUM(i);
+        for (j = PRIME_BIT(p * p); PRIME_NUM(j) <= root; j += p)
+        {
+            __clear_bit(j, prime_bits);
+            prime_base_cnt++;
+        }
+    }
+}
+
+/**
+ * Computes the odd base primes within [3, sqrt(upper_bound)] once, before
+ * any thread is spawned, with prime_sieve_root(), and lists them.
+ * The rest of the bitmap is left to the threads in segmented mode and with sync=partitioned.
+ * There are at most `prime_nroot' of them, which is too many for kmalloc()
+ * once the bound nears 10^12.
+ */
+static int prime_sieve_base(void)
+{
+    unsigned long i;
+
+    prime_base = (unsigned long *)kvmalloc_array(max(prime_nroot, 1UL), sizeof(unsigned long), GFP_KERNEL);
+    if (prime_base == NULL)
+        return -ENOMEM;
+
+    prime_sieve_root();
+    prime_nbase = 0;
+    for (i = find_next_bit(prime_bits, prime_nroot, prime_wheel_from); i < prime_nroot;
+         i = find_next_bit(prime_bits, prime_nroot, i + 1))
+    {
+        prime_base[prime_nbase++] = PRIME_NUM(i);
+    }
+    return 0;
+}
+
+/**
+ * Waits until `*flag' reads `sense'. The calling thread spins for at most
+ * `spin_us' microseconds, which is enough when every thread has a CPU of
+ * its own, and then sleeps on the wait queue of its node. When there are
+ * more threads than CPUs, the partner it waits for may not even be running,
+ * so spinning any longer would only keep that partner off the CPU.
+ * Returns whether the partner had not arrived yet.
+ */
+static bool prime_bar_wait(struct prime_bar_node *node, unsigned int *flag, unsigned int sense)
+{
+    u64 deadline = ktime_get_ns() + prime_cfg.spin_us * NSEC_PER_USEC;
+    bool late = (smp_load_acquire(flag) != sense);
+
+    while (smp_load_acquire(flag) != sense) {
+        if (ktime_get_ns() > deadline) {
+            wait_event_interruptible(node->wq, smp_load_acquire(flag) == sense);
+            continue;
+        }
+        cpu_relax();
+    }
+    return late;
+}
+
+/**
+ * The barrier can be used any number of times in a row.
+ * The k-th thread that arrives at the barrier must wait for the other
+ * n-k threads to arrive. In round r, the thread `id' signals the thread
+ * `id + 2^r' and waits for the signal from the thread `id - 2^r' (modulo
+ * num_threads), so that after ceil(log2(num_threads)) rounds each thread
+ * has transitively heard from all the others. Flags alternate between two
+ * sets, and the value meaning "arrived" flips every other use of the
+ * barrier, so no flag ever needs to be reset.
+ */
+static void prime_barrier(unsigned long id)
+{
+    struct prime_bar_node *node = &prime_bar[id];
+    struct prime_bar_node *partner;
+    struct prime_lock_stats *ls = &prime_stats[id].locks[PRIME_LOCK_BAR];
+    unsigned int r;
+    u64 start_ns = ktime_get_ns(), round_ns;
+    bool late;
+
+    trace_prime_barrier_arrive(id);
+    for (r = 0; r < prime_bar_rounds; r++) {
+        partner = &prime_bar[(id + (1UL << r)) % prime_cfg.num_threads];
+        smp_store_release(&partner->flags[node->parity][r], node->sense);
+        /* Wake the partner up in case it has given up spinning: */
+        if (wq_has_sleeper(&partner->wq))
+            wake_up(&partner->wq);
+        round_ns = ktime_get_ns();
+        late = prime_bar_wait(node, &node->flags[node->parity][r], node->sense);
+        if (static_branch_unlikely(&prime_lock_stats_on)) {
+            ls->acquired++;
+            ls->contended += late;
+            ls->wait_hist[prime_hist_bucket(ktime_get_ns() - round_ns)]++;
+        }
+    }
+    if (node->parity == 1)
+        node->sense = !node->sense;
+    node->parity = 1 - node->parity;
+    round_ns = ktime_get_ns() - start_ns;
+    prime_stats[id].wait_ns += round_ns;
+    trace_prime_barrier_depart(id, round_ns);
+    /* Crossing out done before the barrier is visible to all threads after it: */
+    smp_mb();
+}
+
+/* Counts the bits cleared within the bits [lo, hi) of the bitmap: */
+static unsigned long prime_zeros(unsigned long lo, unsigned long hi)
+{
+    unsigned long w, bits, cnt = 0;
+
+    for (; lo < hi; lo = (w + 1) * BITS_PER_LONG)
+    {
+        w = lo / BITS_PER_LONG;
+        bits = ~prime_bits[w] & BITMAP_FIRST_WORD_MASK(lo);
+        if (hi < (w + 1) * BITS_PER_LONG)
+            bits &= BITMAP_LAST_WORD_MASK(hi);
+        cnt += hweight_long(bits);
+    }
+    return cnt;
+}
+
+/**
+ * Sets up the words [lo, hi) of the bitmap: every odd integer starts as a
+ * candidate, unless the wheel rules it out, and the bits past `prime_nbits'
+ * stay cleared. With a wheel, the pattern is copied in runs that line up
+ * with its period. Returns how many odd integers the wheel crossed out.
+ */
+static unsigned long prime_fill(unsigned long lo, unsigned long hi)
+{
+    unsigned long w, n, len = prime_wheel_len;
+
+    if (lo >= hi)
+        return 0;
+    if (prime_wheel_from == 0)
+        memset(&prime_bits[lo], 0xff, (hi - lo) * sizeof(unsigned long));
+    for (w = lo; (prime_wheel_from != 0) && (w < hi); w += n)
+    {
+        n = min(len - w % len, hi - w);
+        memcpy(&prime_bits[w], &prime_wheel_pattern[w % len], n * sizeof(unsigned long));
+    }
+    if ((hi == BITS_TO_LONGS(prime_nbits)) && (prime_nbits % BITS_PER_LONG))
+        prime_bits[hi - 1] &= BITMAP_LAST_WORD_MASK(prime_nbits);
+    return prime_wheel_from ? prime_zeros(lo * BITS_PER_LONG, min(hi * BITS_PER_LONG, prime_nbits)) : 0;
+}
+
+/**
+ * Sets up the k-th slice of the words of the bitmap that prime_setup()
+ * left to the threads, so that this part of the setup runs in parallel.
+ * The wheel crossing out counts as the thread's own.
+ */
+static void prime_fill_slice(struct prime_stats *st)
+{
+    unsigned long id = st - prime_stats; /* Index of the calling thread */
+    unsigned long words = BITS_TO_LONGS(prime_nbits);
+    unsigned long len = DIV_ROUND_UP(words - prime_fill_from, prime_cfg.num_threads);
+    unsigned long lo = min(prime_fill_from + id * len, words);
+    u64 start_ns = ktime_get_ns();
+
+    st->marks += prime_fill(lo, min(lo + len, words));
+    st->init_ns = ktime_get_ns() - start_ns;
+}
+
+/**
+ * The workqueue counterpart of select_and_mark(). Each work item claims
+ * segments one at a time with an atomic fetch-add on `prime_claim'. As no
+ * thread has set up the bitmap, the item sets up the words of the segment
+ * itself, and then crosses it out while it is still in the cache. Segments
+ * start on word boundaries, so that no two items ever set up the same word.
+ * Items never sleep otherwise, so they give way to other work between segments.
+ */
+static __always_inline void select_and_mark_queued(struct prime_stats *st, const enum prime_sync sync)
+{
+    unsigned long first = round_down(prime_from, BITS_PER_LONG);
+    unsigned long seg, lo, hi;
+    u64 start_ns;
+
+    while ((seg = atomic_long_fetch_add(1, &prime_claim)) < prime_nsegs) {
+        lo = first + seg * prime_seg_len;
+        hi = min(lo + prime_seg_len, prime_nbits);
+        start_ns = ktime_get_ns();
+        st->marks += prime_fill(max(lo / BITS_PER_LONG, prime_fill_from), BITS_TO_LONGS(hi));
+        st->init_ns += ktime_get_ns() - start_ns;
+        __mark_segment(prime_bits, 0, max(lo, prime_from), hi, st, sync);
+        cond_resched();
+    }
+}
+
+/**
+ * Runs the crossing out of the calling thread in the mode the parameters
+ * select, with `sync' as a constant so that prime_threadfn() gets one
+ * specialized copy of the whole sieve per strategy.
+ */
+static __always_inline void prime_sieve(struct prime_stats *st, const enum prime_sync sync)
+{
+    if (prime_ranged)
+        select_and_mark_range(st);
+    else if (prime_queued)
+        select_and_mark_queued(st, sync);
+    else if (sync == PRIME_SYNC_PARTITIONED)
+        select_and_mark_partitioned(st);
+    else if (prime_stealing)
+        select_and_mark_stealing(st, sync);
+    else if (prime_cfg.segmented || prime_extending)
+        select_and_mark_segmented(st, sync);
+    else if (sync == PRIME_SYNC_LOCKFREE)
+        select_and_mark_lockfree(st);
+    else
+        select_and_mark(st, sync);
+}
+
+/**
+ * Counts the primes within [2, n], n being upper_bound, without sieving.
+ * S(v) starts as the number of integers within [2, v], and each prime p
+ * in turn takes out those whose smallest prime factor is p:
+ *     S(v) -= S(v / p) - S(p - 1),  for each v >= p * p in the table.
+ * Once p passes sqrt(n), S(v) = pi(v). Only the values n / i and i, for i
+ * up to sqrt(n), are ever needed, which is what the table holds.
+ *
+ * The entries of a round only read entries of the same round, so each
+ * round runs in two steps split evenly over the threads: every thread
+ * computes the changes of its share from the old table, and, after a
+ * barrier, applies them. Rounds shrink as p grows, and once they are too
+ * small to be worth two barriers, the first thread finishes alone, in
+ * place, updating S(n / i) by increasing i and then S(v) by decreasing v,
+ * so that each entry is read before it is updated.
+ */
+static void prime_count_table(struct prime_stats *st)
+{
+    unsigned long id = st - prime_stats; /* Index of the calling thread */
+    unsigned long n = prime_cfg.upper_bound, r = prime_count_root;
+    unsigned long *hi = prime_table, *lo = hi + r + 1, *dhi = lo + r + 1, *dlo = dhi + r + 1;
+    unsigned long p, sp, nhi, nlo, len, i, v, hi_from, hi_to, lo_from, lo_to;
+
+    for (p = 2; p <= r; p++) {
+        if (lo[p] == lo[p - 1]) /* p is not prime */
+            continue;
+        sp = lo[p - 1];
+        nhi = min(r, n / (p * p));              /* S(n / i) for i within [1, nhi] */
+        nlo = (p * p <= r) ? r + 1 - p * p : 0; /* S(v) for v within [p * p, r] */
+        if (nhi + nlo < PRIME_COUNT_MIN_ENTRIES * prime_cfg.num_threads)
+            break;
+        len = DIV_ROUND_UP(nhi, prime_cfg.num_threads);
+        hi_from = min(nhi, id * len) + 1;
+        hi_to = min(nhi, (id + 1) * len) + 1;
+        len = DIV_ROUND_UP(nlo, prime_cfg.num_threads);
+        lo_from = p * p + min(nlo, id * len);
+        lo_to = p * p + min(nlo, (id + 1) * len);
+        for (i = hi_from; i < hi_to; i++) {
+            dhi[i] = ((i * p <= r) ? hi[i * p] : lo[n / (i * p)]) - sp;
+        }
+        for (v = lo_from; v < lo_to; v++) {
+            dlo[v] = lo[v / p] - sp;
+        }
+        prime_barrier(id);
+        for (i = hi_from; i < hi_to; i++) {
+            hi[i] -= dhi[i];
+        }
+        for (v = lo_from; v < lo_to; v++) {
+            lo[v] -= dlo[v];
+        }
+        st->updates += (hi_to - hi_from) + (lo_to - lo_from);
+        prime_barrier(id);
+    }
+    if (id != 0)
+        return;
+    for (; p <= r; p++) {
+        if (lo[p] == lo[p - 1])
+            continue;
+        sp = lo[p - 1];
+        nhi = min(r, n / (p * p));
+        for (i = 1; i <= nhi; i++) {
+            hi[i] -= ((i * p <= r) ? hi[i * p] : lo[n / (i * p)]) - sp;
+        }
+        for (v = r; v >= p * p; v--) {
+            lo[v] -= lo[v / p] - sp;
+        }
+        st->updates += nhi + ((p * p <= r) ? r + 1 - p * p : 0);
+    }
+}
+
+/* Runs prime_sieve() specialized for the strategy `sync' names: */
+static void prime_run(struct prime_stats *st)
+{
+    switch (prime_sync) {
+    case PRIME_SYNC_SPINLOCK:
+        prime_sieve(st, PRIME_SYNC_SPINLOCK);
+        break;
+    case PRIME_SYNC_ATOMIC:
+        prime_sieve(st, PRIME_SYNC_ATOMIC);
+        break;
+    case PRIME_SYNC_PARTITIONED:
+        prime_sieve(st, PRIME_SYNC_PARTITIONED);
+        break;
+    case PRIME_SYNC_MUTEX:
+        prime_sieve(st, PRIME_SYNC_MUTEX);
+        break;
+    case PRIME_SYNC_LOCKFREE:
+        prime_sieve(st, PRIME_SYNC_LOCKFREE);
+        break;
+    }
+}
+
+/**
+ * @st - tracks how many non-prime numbers has crossed out, and when.
+ * This function run by each spawned thread sequentially:
+ * (a) calls a function that performs barrier synchronization
+ *     with the other threads, sets up its own slice of the bitmap,
+ *     and synchronizes again, after which the first thread stamps
+ *     the time all threads were set up,
+ * (b) calls a function that repeatedly marks non-prime numbers
+ *     in the array until the entire array is processed, and in
+ *     count-only mode, or instead of it, counts the primes,
+ * (c) calls the barrier function again, after which the first thread
+ *     stamps the time all threads completed processing, and
+ * (d) signals the completion that prime_finish() waits for.
+ */
+static int prime_threadfn(void *st)
+{
+    struct prime_stats *stats = (struct prime_stats *)st;
+    unsigned long id = stats - prime_stats; /* Index of this thread */
+
+    prime_barrier(id);
+    prime_fill_slice(stats);
+    prime_barrier(id);
+    if (id == 0)
+        WRITE_ONCE(prime_first_ns, ktime_get_ns());
+    stats->start_ns = ktime_get_ns();
+    if (!prime_counting || prime_checking)
+        prime_run(stats);
+    if (prime_counting)
+        prime_count_table(stats);
+    stats->finish_ns = ktime_get_ns();
+    trace_prime_thread_finish(id, stats->marks, stats->claims, stats->finish_ns - stats->start_ns);
+    prime_barrier(id);
+    if (id == 0)
+    {
+        WRITE_ONCE(prime_second_ns, ktime_get_ns());
+        complete_all(&prime_done);
+    }
+    return 0;
+}
+
+/**
+ * The work item counterpart of prime_threadfn(), for the item whose
+ * statistics are `stats'. Items do not wait for each other, as each one
+ * sets up what it crosses out, so there is no barrier: the last item to
+ * finish stamps the time and signals the completion instead.
+ */
+static void prime_item_run(struct prime_stats *stats)
+{
+    unsigned long id = stats - prime_stats; /* Index of this item */
+
+    stats->start_ns = ktime_get_ns();
+    prime_run(stats);
+    stats->finish_ns = ktime_get_ns();
+    trace_prime_thread_finish(id, stats->marks, stats->claims, stats->finish_ns - stats->start_ns);
+    if (atomic_dec_and_test(&prime_pending))
+    {
+        WRITE_ONCE(prime_second_ns, ktime_get_ns());
+        complete_all(&prime_done);
+    }
+}
+
+/* Prints the interval [from_ns, to_ns] in seconds, as `what' took: */
+static void prime_print_interval(const char *what, u64 from_ns, u64 to_ns)
+{
+    u32 nsec;
+    u64 sec;
+
+    if (from_ns > to_ns)
+    {
+        printk(KERN_ALERT "Function arguments invalid!\n");
+        return;
+    }
+    sec = div_u64_rem(to_ns - from_ns, NSEC_PER_SEC, &nsec);
+    printk(KERN_INFO "%s: %09llu.%09u seconds.\n", what, sec, nsec);
+}
+
+/**
+ * Counts the crossing out that the original strategy performs on a
+ * race-free run, which claims every prime p within [2, upper_bound] and
+ * crosses out each of 2p, 3p, ... up to upper_bound. This is the figure
+ * reported in the "unnecessary crossing out" column of the Lab2 CSVs.
+ */
+static unsigned long prime_naive_marks(void)
+{
+    unsigned long k;
+    unsigned long cnt = prime_cfg.upper_bound / 2 - 1; /* Multiples of 2 */
+
+    for (k = find_first_bit(prime_bits, prime_nbits); k < prime_nbits;
+         k = find_next_bit(prime_bits, prime_nbits, k + 1))
+    {
+        cnt += prime_cfg.upper_bound / PRIME_NUM(k) - 1;
+    }
+    return cnt;
+}
+
+/**
+ * Prints what each thread did, so that load imbalance between threads
+ * shows up, not only the totals. Times are relative to the earliest start.
+ */
+static void prime_print_threads(void)
+{
+    unsigned long i;
+    u64 first_ns = U64_MAX, run_ns, min_ns = U64_MAX, max_ns = 0;
+
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        first_ns = min(first_ns, prime_stats[i].start_ns);
+    }
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        run_ns = prime_stats[i].finish_ns - prime_stats[i].start_ns;
+        min_ns = min(min_ns, run_ns);
+        max_ns = max(max_ns, run_ns);
+        printk(KERN_INFO "Thread %lu: %lu crossing out, %lu claims, %lu steals, set up in %llu ns, ran from %llu to %llu ns, waited %llu ns at the barriers.\n",
+               i, prime_stats[i].marks, prime_stats[i].claims, prime_stats[i].steals, prime_stats[i].init_ns,
+               prime_stats[i].start_ns - first_ns,
+               prime_stats[i].finish_ns - first_ns, prime_stats[i].wait_ns);
+    }
+    printk(KERN_INFO "The busiest thread ran for %llu ns, the idlest for %llu ns.\n", max_ns, min_ns);
+}
+
+/**
+ * Prints, for each lock watched with `lock_stats', how often it was taken
+ * and found held, and the histograms of wait and hold times summed over
+ * all threads, one line per bucket that is not empty. The barrier has no
+ * hold times, only waits.
+ */
+static void prime_print_locks(void)
+{
+    static const char *const mutex_names[] = {"prime_mutex_1", "prime_mutex_2", "barrier"};
+    static const char *const lock_names[] = {"prime_lock_1", "prime_lock_2", "barrier"};
+    struct prime_lock_stats sum;
+    const char *name;
+    unsigned long i, b, l;
+
+    for (l = 0; l < PRIME_NLOCKS; l++)
+    {
+        memset(&sum, 0, sizeof(sum));
+        for (i = 0; i < prime_cfg.num_threads; i++)
+        {
+            sum.acquired += prime_stats[i].locks[l].acquired;
+            sum.contended += prime_stats[i].locks[l].contended;
+            for (b = 0; b < PRIME_HIST_BUCKETS; b++)
+            {
+                sum.wait_hist[b] += prime_stats[i].locks[l].wait_hist[b];
+                sum.hold_hist[b] += prime_stats[i].locks[l].hold_hist[b];
+            }
+        }
+        if (sum.acquired == 0)
+            continue;
+        name = (prime_sync == PRIME_SYNC_MUTEX) ? mutex_names[l] : lock_names[l];
+        printk(KERN_INFO "Lock %s: %lu acquisitions, %lu contended.\n", name, sum.acquired, sum.contended);
+        for (b = 0; b < PRIME_HIST_BUCKETS; b++)
+        {
+            if (l == PRIME_LOCK_BAR && sum.wait_hist[b])
+                printk(KERN_INFO "Lock %s: [%llu, %llu) ns waited %lu times.\n", name,
+                       b ? 1ULL << (b - 1) : 0ULL, 1ULL << b, sum.wait_hist[b]);
+            else if (l != PRIME_LOCK_BAR && (sum.wait_hist[b] || sum.hold_hist[b]))
+                printk(KERN_INFO "Lock %s: [%llu, %llu) ns waited %lu times, held %lu times.\n", name,
+                       b ? 1ULL << (b - 1) : 0ULL, 1ULL << b, sum.wait_hist[b], sum.hold_hist[b]);
+        }
+    }
+}
+
+/* Counts the primes within [2, upper_bound] once the sieve is done: */
+static unsigned long prime_count(void)
+{
+    return 1 + prime_nbits - prime_zeros(0, prime_nbits); /* 2 is the only even prime */
+}
+
+/* Reads pi(upper_bound) off the table once count-only mode is done: */
+static unsigned long prime_table_count(void)
+{
+    return prime_table[1];
+}
+
+/* Counts the primes found so far in range mode, as no bitmap of the range is kept: */
+static unsigned long prime_range_count(void)
+{
+    unsigned long i, cnt = (prime_cfg.lower_bound <= 2) ? 1 : 0;
+
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        cnt += READ_ONCE(prime_stats[i].primes);
+    }
+    return cnt;
+}
+
+/* Counts the crossing out so far, including the sieves this one extends: */
+static unsigned long prime_marks(void)
+{
+    unsigned long i, cnt = prime_prev_cnt + prime_base_cnt;
+
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        cnt += READ_ONCE(prime_stats[i].marks);
+    }
+    return cnt;
+}
+
+static void prime_print(void)
+{
+    unsigned long num_prime, num_marked, num_odd_composite, num_naive, num_updates, i;
+
+    printk(KERN_INFO "There are %lu threads and the largest integer being processed is %lu.\n", prime_cfg.num_threads, prime_cfg.upper_bound);
+    printk(KERN_INFO "Synchronization: %s.\n", prime_sync_names[prime_sync]);
+    if (prime_extending)
+        printk(KERN_INFO "Extended an earlier sieve, crossing out from %lu on only.\n", PRIME_NUM(prime_from));
+    if (prime_ranged)
+        printk(KERN_INFO "Range mode: %lu odd base primes, windows of %lu odd integers.\n", prime_nbase, prime_win_len);
+    else if (prime_queued)
+        printk(KERN_INFO "Workqueue mode: %lu work items on the %s workqueue, %lu segments of %lu bits.\n",
+               prime_cfg.num_threads, (prime_cfg.workqueue == 2) ? "per-CPU" : "unbound", prime_nsegs, prime_seg_len);
+    else if (prime_sync == PRIME_SYNC_PARTITIONED)
+        printk(KERN_INFO "Partitioned mode: %lu odd base primes, one range per thread crossed out with plain stores.\n", prime_nbase);
+    else if (prime_stealing)
+        printk(KERN_INFO "Work-stealing mode: %lu odd base primes, %lu segments of %lu bits.\n",
+               prime_nbase, prime_nsegs, prime_seg_len);
+    else if (prime_cfg.segmented || prime_extending)
+        printk(KERN_INFO "Segmented mode: %lu odd base primes, %lu bits per segment.\n", prime_nbase, prime_seg_len);
+    if (prime_counting)
+        printk(KERN_INFO "Count-only mode: a table of 2 x %lu counts, %s.\n", prime_count_root,
+               prime_checking ? "checked against the sieve" : "no sieve");
+    if (prime_wheel_from)
+        printk(KERN_INFO "Wheel mode: multiples of the primes dividing %lu stamped, crossing out from %lu on.\n",
+               prime_cfg.wheel, PRIME_NUM(prime_wheel_from));
+    if ((prime_sync == PRIME_SYNC_LOCKFREE) && !prime_ranged)
+        printk(KERN_INFO "Lock-free mode: %s claimed with an atomic fetch-add.\n",
+               prime_cfg.segmented ? "segments" : "chunks of base prime bits");
+    if (prime_cfg.pin_threads)
+        printk(KERN_INFO "Threads pinned to %lu online CPUs, bitmap pages allocated on their nodes.\n",
+               min_t(unsigned long, prime_cfg.num_threads, num_online_cpus()));
+
+    num_marked = prime_marks();
+    if (prime_ranged)
+    {
+        num_prime = prime_range_count();
+        printk(KERN_INFO "There are %lu primes within [%lu, %lu].\n", num_prime, prime_cfg.lower_bound, prime_cfg.upper_bound);
+        printk(KERN_INFO "There are %lu crossing out.\n", num_marked);
+    }
+    else if (prime_counting && !prime_checking)
+    {
+        num_prime = prime_table_count();
+        printk(KERN_INFO "There are %lu primes and %lu non-primes within [2, %lu].\n", num_prime, (prime_cfg.upper_bound - num_prime - 1), prime_cfg.upper_bound);
+    }
+    else
+    {
+        num_prime = prime_count();
+        num_odd_composite = prime_nbits - (num_prime - 1);
+        printk(KERN_INFO "There are %lu primes and %lu non-primes within [2, %lu].\n", num_prime, (prime_cfg.upper_bound - num_prime - 1), prime_cfg.upper_bound);
+        printk(KERN_INFO "There are %lu unnecessary crossing out.\n", num_marked - num_odd_composite);
+        num_naive = prime_naive_marks();
+        printk(KERN_INFO "There are %lu crossing out, versus %lu (%lu unnecessary) for the original strategy.\n",
+               num_marked, num_naive, num_naive - (prime_cfg.upper_bound - num_prime - 1));
+    }
+    if (prime_counting)
+    {
+        for (i = 0, num_updates = 0; i < prime_cfg.num_threads; i++)
+        {
+            num_updates += prime_stats[i].updates;
+        }
+        printk(KERN_INFO "There are %lu updates of the table.\n", num_updates);
+    }
+    if (prime_checking)
+        printk(KERN_INFO "Counting without sieving found %lu primes, %s.\n", prime_table_count(),
+               (prime_table_count() == prime_count()) ? "as the sieve did" : "UNLIKE THE SIEVE");
+    prime_print_threads();
+    if (static_branch_unlikely(&prime_lock_stats_on))
+        prime_print_locks();
+
+    prime_print_interval("Time spent on setting up the module", prime_init_ns, prime_first_ns);
+    prime_print_interval("Time spent on prime computation", prime_first_ns, prime_second_ns);
+    prime_print_interval("Total time spent", prime_init_ns, prime_second_ns);
+}
+
+/* Frees whatever prime_setup() has allocated so far: */
+static void prime_free(void)
+{
+    unsigned long i;
+
+    if (prime_win != NULL)
+    {
+        for (i = 0; i < prime_cfg.num_threads; i++)
+        {
+            vfree(prime_win[i]);
+        }
+        kfree(prime_win);
+    }
+    prime_free_bits(prime_bits, prime_pages, prime_npages);
+    kfree(prime_cpu);
+    kfree(prime_stats);
+    kvfree(prime_base);
+    kfree(prime_bar);
+    kfree(prime_deques);
+    kfree(prime_wheel_pattern);
+    vfree(prime_table);
+    prime_bits = NULL;
+    prime_pages = NULL;
+    prime_cpu = NULL;
+    prime_stats = NULL;
+    prime_base = NULL;
+    prime_bar = NULL;
+    prime_deques = NULL;
+    prime_win = NULL;
+    prime_wheel_pattern = NULL;
+    prime_wheel_len = 0;
+    prime_table = NULL;
+}
+
+/**
+ * Builds the pattern of the odd integers free of the primes dividing
+ * `wheel'. As 2 * BITS_PER_LONG * P is a multiple of all of them, where P
+ * is their product, the bitmap repeats every P words, so the pattern is P
+ * words long and prime_fill() copies it over and over. The primes of the
+ * wheel themselves are crossed out with their multiples, and set again by
+ * prime_setup().
+ */
+static int prime_build_wheel(void)
+{
+    unsigned long i, j, q, len = prime_cfg.wheel / 2;
+
+    prime_wheel_pattern = (unsigned long *)kmalloc(len * sizeof(unsigned long), GFP_KERNEL);
+    if (prime_wheel_pattern == NULL)
+        return -ENOMEM;
+    prime_wheel_len = len;
+    memset(prime_wheel_pattern, 0xff, len * sizeof(unsigned long));
+    for (j = 0; j < ARRAY_SIZE(prime_wheel_primes) && (prime_cfg.wheel % prime_wheel_primes[j] == 0); j++)
+    {
+        q = prime_wheel_primes[j];
+        for (i = PRIME_BIT(q); i < len * BITS_PER_LONG; i += q)
+        {
+            __clear_bit(i, prime_wheel_pattern);
+        }
+    }
+    return 0;
+}
+
+/* Checks the parameters `cfg' before anything is set up, saying what is wrong with them: */
+static int prime_config_check(const struct prime_config *cfg)
+{
+    if ((cfg->sync < 0) || (cfg->num_threads < 1) || (cfg->num_threads > PRIME_MAX_THREADS) ||
+        (cfg->upper_bound < 2) || (cfg->chunk_size < 1) || (cfg->lower_bound > cfg->upper_bound) ||
+        ((cfg->wheel != 0) && (cfg->wheel != 30) && (cfg->wheel != 210) && (cfg->wheel != 2310)) ||
+        (cfg->workqueue > 2))
+    {
+        printk(KERN_ALERT "User-specified module parameter invalid!\n");
+        if (cfg->sync < 0)
+            printk(KERN_ALERT "sync must be spinlock, atomic, partitioned, mutex or lockfree!\n");
+        else if ((cfg->num_threads < 1) || (cfg->num_threads > PRIME_MAX_THREADS))
+        {
+            printk(KERN_ALERT "num_threads must be within [1, %lu]!\n", PRIME_MAX_THREADS);
+        }
+        else if (cfg->upper_bound < 2)
+            printk(KERN_ALERT "upper_bound must be greater than or equal to 2!\n");
+        else if (cfg->chunk_size < 1)
+            printk(KERN_ALERT "chunk_size must be greater than or equal to 1!\n");
+        else if (cfg->lower_bound > cfg->upper_bound)
+            printk(KERN_ALERT "lower_bound must be less than or equal to upper_bound!\n");
+        else if (cfg->workqueue > 2)
+            printk(KERN_ALERT "workqueue must be 0, 1 or 2!\n");
+        else
+            printk(KERN_ALERT "wheel must be 0, 30, 210 or 2310!\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * Sets up a sieve of [2, upper_bound] with the parameters `cfg', which are
+ * kept in `prime_cfg', up to the point where `num_threads' threads can run
+ * prime_threadfn(), or work items prime_item_run(). On failure, whatever
+ * was allocated is freed again. If `old_bits' is not NULL, it holds a
+ * finished sieve of the first `old_nbits' bits, which is copied over so
+ * that only the rest is sieved.
+ */
+static int prime_setup(const struct prime_config *cfg, const unsigned long *old_bits, unsigned long old_nbits)
+{
+    unsigned long i;
+    unsigned int cpu;
+
+    /* Initialization time-stamped before doing anything else: */
+    prime_init_ns = ktime_get_ns();
+    prime_cfg = *cfg;
+    WRITE_ONCE(prime_first_ns, 0);
+    WRITE_ONCE(prime_second_ns, 0);
+
+    prime_bits = NULL;
+    prime_nbits = 0;
+    prime_pages = NULL;
+    prime_npages = 0;
+    prime_cpu = NULL;
+    prime_stats = NULL;
+    prime_base = NULL;
+    prime_nbase = 0;
+    prime_base_cnt = 0;
+    prime_extending = (old_bits != NULL);
+    prime_ranged = (prime_cfg.lower_bound != 0) && !prime_extending;
+    prime_wheel_from = 0;
+    prime_wheel_pattern = NULL;
+    prime_wheel_len = 0;
+    prime_win = NULL;
+    prime_bar = NULL;
+    prime_deques = NULL;
+    prime_table = NULL;
+    atomic_long_set(&prime_claim, 0);
+    reinit_completion(&prime_done);
+
+    if (prime_config_check(cfg) != 0)
+    {
+        prime_cfg.num_threads = 0;
+        prime_cfg.upper_bound = 0;
+        return -EINVAL;
+    }
+    prime_sync = cfg->sync;
+    prime_counting = prime_cfg.count_only && !prime_ranged && !prime_extending;
+    prime_checking = prime_counting && (prime_cfg.upper_bound <= PRIME_COUNT_CHECK_MAX);
+    /* The count waits on barriers between its rounds, which work items do not have: */
+    prime_queued = (prime_cfg.workqueue != 0) && !prime_ranged && !prime_counting;
+    prime_stealing = prime_cfg.steal && (prime_sync != PRIME_SYNC_PARTITIONED) && !prime_ranged && !prime_queued;
+    if (prime_cfg.lock_stats)
+        static_branch_enable(&prime_lock_stats_on);
+    else
+        static_branch_disable(&prime_lock_stats_on);
+
+    /*
+     * Odd integers within [3, upper_bound], plus a word so the map is never
+     * empty. Range mode, and count-only mode past the bound it is checked
+     * at, only keep those within [3, sqrt(upper_bound)].
+     */
+    prime_nroot = (int_sqrt(prime_cfg.upper_bound) - 1) / 2;
+    prime_nbits = (prime_ranged || (prime_counting && !prime_checking)) ? prime_nroot : (prime_cfg.upper_bound - 1) / 2;
+    /* Crossing out resumes at the first prime that does not divide the wheel: */
+    if (prime_cfg.wheel && !prime_ranged && !(prime_counting && !prime_checking))
+    {
+        for (i = 0; prime_cfg.wheel % prime_wheel_primes[i] == 0; i++);
+        prime_wheel_from = PRIME_BIT(prime_wheel_primes[i]);
+    }
+    prime_pos = prime_wheel_from;
+    /* Segments start at the first odd integer above sqrt(upper_bound), or above the old sieve: */
+    prime_from = prime_extending ? old_nbits : prime_nroot;
+    if (prime_cfg.segment_size)
+        prime_seg_len = prime_cfg.segment_size;
+    else /* One L2 worth of bits, but no fewer segments than threads, or than there are to steal: */
+        prime_seg_len = min_t(unsigned long, PRIME_SEGMENT_BYTES * BITS_PER_BYTE,
+                              DIV_ROUND_UP(prime_nbits - prime_from,
+                                           prime_cfg.num_threads * (prime_stealing ? PRIME_STEAL_SEGMENTS : 1)));
+    /* No longer than what there is to sieve, so that segment arithmetic never wraps: */
+    prime_seg_len = min(prime_seg_len, prime_nbits - round_down(prime_from, BITS_PER_LONG));
+    prime_seg_len = max_t(unsigned long, round_up(prime_seg_len, BITS_PER_LONG), BITS_PER_LONG);
+    prime_nsegs = DIV_ROUND_UP(prime_nbits - round_down(prime_from, BITS_PER_LONG), prime_seg_len);
+
+    /* The k-th thread, or per-CPU work item, goes to the k-th online CPU, wrapping around: */
+    if (prime_cfg.pin_threads || (prime_cfg.workqueue == 2))
+    {
+        prime_cpu = (unsigned int *)kmalloc(prime_cfg.num_threads * sizeof(unsigned int), GFP_KERNEL);
+        if (prime_cpu == NULL)
+        {
+            printk(KERN_ALERT "kmalloc for prime_cpu failed!\n");
+            return -ENOMEM;
+        }
+        cpu = cpumask_first(cpu_online_mask);
+        for (i = 0; i < prime_cfg.num_threads; i++)
+        {
+            prime_cpu[i] = cpu;
+            cpu = cpumask_next(cpu, cpu_online_mask);
+            if (cpu >= nr_cpu_ids)
+                cpu = cpumask_first(cpu_online_mask);
+        }
+    }
+
+    prime_bits = prime_alloc_bits(BITS_TO_LONGS(prime_nbits));
+    if (prime_bits == NULL)
+    {
+        printk(KERN_ALERT "vmap for prime_bits failed!\n");
+        prime_free();
+        return -ENOMEM;
+    }
+
+    /* Every count and time starts at zero: */
+    prime_stats = (struct prime_stats *)kcalloc(prime_cfg.num_threads, sizeof(struct prime_stats), GFP_KERNEL);
+    if (prime_stats == NULL)
+    {
+        printk(KERN_ALERT "kcalloc for prime_stats failed!\n");
+        prime_free();
+        return -ENOMEM;
+    }
+
+    /* Each thread sieves its windows in a buffer of its own, local to its node if pinned: */
+    if (prime_ranged)
+    {
+        /* No longer than the range, so that window arithmetic never wraps either: */
+        prime_win_len = min(prime_cfg.window_size ? prime_cfg.window_size : PRIME_SEGMENT_BYTES * BITS_PER_BYTE,
+                            (prime_cfg.upper_bound - 1) / 2 - PRIME_BIT(max(prime_cfg.lower_bound, 3UL) | 1));
+        prime_win_len = max_t(unsigned long, round_up(prime_win_len, BITS_PER_LONG), BITS_PER_LONG);
+        prime_win = (unsigned long **)kcalloc(prime_cfg.num_threads, sizeof(unsigned long *), GFP_KERNEL);
+        if (prime_win == NULL)
+        {
+            printk(KERN_ALERT "kcalloc for prime_win failed!\n");
+            prime_free();
+            return -ENOMEM;
+        }
+        for (i = 0; i < prime_cfg.num_threads; i++)
+        {
+            prime_win[i] = (unsigned long *)vmalloc_node(BITS_TO_LONGS(prime_win_len) * sizeof(unsigned long),
+                                                         prime_cfg.pin_threads ? cpu_to_node(prime_cpu[i]) : NUMA_NO_NODE);
+            if (prime_win[i] == NULL)
+            {
+                printk(KERN_ALERT "vmalloc for prime_win failed!\n");
+                prime_free();
+                return -ENOMEM;
+            }
+        }
+    }
+
+    /* Each S(v) starts as the number of integers within [2, v]: */
+    if (prime_counting)
+    {
+        prime_count_root = int_sqrt(prime_cfg.upper_bound);
+        prime_table = (unsigned long *)vmalloc(array_size(4 * (prime_count_root + 1), sizeof(unsigned long)));
+        if (prime_table == NULL)
+        {
+            printk(KERN_ALERT "vmalloc for prime_table failed!\n");
+            prime_free();
+            return -ENOMEM;
+        }
+        for (i = 1; i <= prime_count_root; i++)
+        {
+            prime_table[i] = prime_cfg.upper_bound / i - 1;
+            prime_table[prime_count_root + 1 + i] = i - 1;
+        }
+        prime_table[prime_count_root + 1] = 0;
+    }
+
+    /* Flags start cleared, and every thread starts out waiting for a 1: */
+    prime_bar = (struct prime_bar_node *)kcalloc(prime_cfg.num_threads, sizeof(struct prime_bar_node), GFP_KERNEL);
+    if (prime_bar == NULL)
+    {
+        printk(KERN_ALERT "kcalloc for prime_bar failed!\n");
+        prime_free();
+        return -ENOMEM;
+    }
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        prime_bar[i].sense = 1;
+        init_waitqueue_head(&prime_bar[i].wq);
+    }
+    for (prime_bar_rounds = 0; (1UL << prime_bar_rounds) < prime_cfg.num_threads; prime_bar_rounds++);
+
+    /* The k-th thread starts with the k-th run of segments: */
+    if (prime_stealing)
+    {
+        prime_deques = (struct prime_deque *)kcalloc(prime_cfg.num_threads, sizeof(struct prime_deque), GFP_KERNEL);
+        if (prime_deques == NULL)
+        {
+            printk(KERN_ALERT "kcalloc for prime_deques failed!\n");
+            prime_free();
+            return -ENOMEM;
+        }
+        for (i = 0; i < prime_cfg.num_threads; i++)
+        {
+            spin_lock_init(&prime_deques[i].lock);
+            prime_deques[i].head = i * prime_nsegs / prime_cfg.num_threads;
+            prime_deques[i].tail = (i + 1) * prime_nsegs / prime_cfg.num_threads;
+        }
+    }
+
+    if ((prime_wheel_from != 0) && (prime_build_wheel() != 0))
+    {
+        printk(KERN_ALERT "kmalloc for prime_wheel_pattern failed!\n");
+        prime_free();
+        return -ENOMEM;
+    }
+
+    /*
+     * Only the words holding the base primes, or the old sieve, are set up
+     * here, as they are needed before any thread runs. The threads set up
+     * the rest themselves, see prime_fill_slice().
+     */
+    prime_fill_from = min(BITS_TO_LONGS(prime_nbits),
+                          max(1UL, BITS_TO_LONGS(prime_extending ? old_nbits : prime_nroot)));
+    prime_fill(0, prime_fill_from);
+    for (i = 0; (prime_wheel_from != 0) && (i < ARRAY_SIZE(prime_wheel_primes)) &&
+                (prime_cfg.wheel % prime_wheel_primes[i] == 0); i++)
+    {
+        if (PRIME_BIT(prime_wheel_primes[i]) < prime_nbits)
+            __set_bit(PRIME_BIT(prime_wheel_primes[i]), prime_bits);
+    }
+    /* The old sieve is kept, while the bits past it in its last word stay candidates: */
+    if (prime_extending)
+    {
+        memcpy(prime_bits, old_bits, (old_nbits / BITS_PER_LONG) * sizeof(unsigned long));
+        if (old_nbits % BITS_PER_LONG)
+            prime_bits[old_nbits / BITS_PER_LONG] &= old_bits[old_nbits / BITS_PER_LONG] |
+                                                    ~BITMAP_LAST_WORD_MASK(old_nbits);
+    }
+    /* Numbers the wheel crossed out count once each, past the old sieve if any: */
+    if (prime_wheel_from != 0)
+        prime_base_cnt += prime_zeros(prime_extending ? old_nbits : 0,
+                                      min(prime_fill_from * BITS_PER_LONG, prime_nbits));
+
+    /* Count-only mode needs no base primes, only the prefix sieved for PRIME_IOC_QUERY: */
+    if (prime_counting && !prime_checking)
+        prime_sieve_root();
+    else if ((prime_cfg.segmented || prime_stealing || prime_queued || (prime_sync == PRIME_SYNC_PARTITIONED) ||
+              prime_extending || prime_ranged) &&
+             (prime_sieve_base() != 0))
+    {
+        printk(KERN_ALERT "kvmalloc for prime_base failed!\n");
+        prime_free();
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+#endif /* PRIMES_ENGINE_H */
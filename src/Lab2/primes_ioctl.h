@@ -0,0 +1,50 @@
+/* Interface of the /dev/primes device, shared by the module and userspace. */
+#ifndef PRIMES_IOCTL_H
+#define PRIMES_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * The sieve keeps one bit per odd integer: bit k of the bitmap, counted
+ * within unsigned long words of the kernel, stands for 2k + 3. The bitmap
+ * can be mapped read-only with mmap() at offset 0, for `map_bytes' bytes.
+ * A mapping keeps showing the bitmap it was made from, so it must be made
+ * again after each PRIME_IOC_SIEVE.
+ */
+struct prime_sieve {
+    __u64 upper_bound; /* In: sieve [2, upper_bound] */
+    __u64 num_threads; /* In: threads crossing out */
+    __u64 num_primes;  /* Out: primes within [2, upper_bound] */
+    __u64 map_bytes;   /* Out: bytes of the bitmap to mmap(), 0 if only counted */
+    __u64 sieved_from; /* Out: crossing out started here, the rest was reused */
+};
+
+/*
+ * Batched primality queries, for any 64-bit value: each of the `count'
+ * values at `nums' is looked up in the bitmap of the last sieve when it
+ * falls within it and no sieve is under way, and tested with deterministic
+ * Miller-Rabin otherwise.
+ * The answer to the k-th value is written to the k-th byte at `results',
+ * as PRIME_QUERY_* flags. At most PRIME_QUERY_MAX values per call.
+ */
+struct prime_query {
+    __u64 nums;    /* In: address of the __u64 values to test */
+    __u64 results; /* In: address of the __u8 answers, one per value */
+    __u64 count;   /* In: values to test */
+    __u64 sieved;  /* Out: values answered from the bitmap */
+};
+
+#define PRIME_QUERY_MAX 4096
+#define PRIME_QUERY_PRIME 0x1  /* The value is prime */
+#define PRIME_QUERY_SIEVED 0x2 /* Answered from the bitmap, not by Miller-Rabin */
+
+#define PRIME_IOC_MAGIC 'p'
+/* Sieves again with the given bounds, and waits until it is done: */
+#define PRIME_IOC_SIEVE _IOWR(PRIME_IOC_MAGIC, 1, struct prime_sieve)
+/* Describes the last sieve without running it again: */
+#define PRIME_IOC_INFO _IOR(PRIME_IOC_MAGIC, 2, struct prime_sieve)
+/* Answers a batch of primality queries, without waiting for a sieve under way: */
+#define PRIME_IOC_QUERY _IOWR(PRIME_IOC_MAGIC, 3, struct prime_query)
+
+#endif /* PRIMES_IOCTL_H */
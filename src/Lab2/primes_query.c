@@ -0,0 +1,108 @@
+/*
+ * Asks /dev/primes to sieve [2, upper_bound] with some threads, maps the
+ * resulting bitmap and answers whether each further argument is prime.
+ * Arguments beyond the bound, or all of them when there is no bitmap to
+ * map, are sent in batches to PRIME_IOC_QUERY, which tests them with
+ * Miller-Rabin instead.
+ * Build with: gcc -Wall -o primes_query primes_query.c
+ * Usage: ./primes_query upper_bound num_threads [n ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "primes_ioctl.h"
+
+#define BITS_PER_WORD (sizeof(unsigned long) * CHAR_BIT)
+
+static int is_prime(const unsigned long *bits, unsigned long long n)
+{
+	unsigned long long k;
+
+	if (n == 2)
+		return 1;
+	if (n < 2 || n % 2 == 0)
+		return 0;
+	k = (n - 3) / 2;
+	return (bits[k / BITS_PER_WORD] >> (k % BITS_PER_WORD)) & 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct prime_sieve req;
+	struct prime_query query;
+	unsigned long *bits = NULL;
+	__u64 far[PRIME_QUERY_MAX];
+	__u8 answers[PRIME_QUERY_MAX];
+	unsigned long long n;
+	int fd, i, j, nfar;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s upper_bound num_threads [n ...]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((fd = open("/dev/primes", O_RDONLY)) == -1) {
+		fprintf(stderr, "Error: open /dev/primes: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.upper_bound = strtoull(argv[1], NULL, 0);
+	req.num_threads = strtoull(argv[2], NULL, 0);
+	if (ioctl(fd, PRIME_IOC_SIEVE, &req) == -1) {
+		fprintf(stderr, "Error: PRIME_IOC_SIEVE: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	printf("There are %llu primes within [2, %llu].\n", req.num_primes, req.upper_bound);
+	if (req.sieved_from > 2)
+		printf("Only [%llu, %llu] was sieved, the rest was reused.\n", req.sieved_from, req.upper_bound);
+
+	if (argc > 3 && req.map_bytes > 0) {
+		bits = mmap(NULL, req.map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+		if (bits == MAP_FAILED) {
+			fprintf(stderr, "Error: mmap /dev/primes: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 3; i < argc; i = j) {
+		/* Values the bitmap cannot answer, up to the next one it can, go in one batch: */
+		for (j = i, nfar = 0; j < argc && nfar < PRIME_QUERY_MAX; j++) {
+			n = strtoull(argv[j], NULL, 0);
+			if (n <= req.upper_bound && bits != NULL)
+				break;
+			far[nfar++] = n;
+		}
+		if (nfar > 0) {
+			memset(&query, 0, sizeof(query));
+			query.nums = (__u64)(unsigned long)far;
+			query.results = (__u64)(unsigned long)answers;
+			query.count = nfar;
+			if (ioctl(fd, PRIME_IOC_QUERY, &query) == -1) {
+				fprintf(stderr, "Error: PRIME_IOC_QUERY: %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			for (j = 0; j < nfar; j++)
+				printf("%llu: %s%s\n", (unsigned long long)far[j],
+				       (answers[j] & PRIME_QUERY_PRIME) ? "prime" : "not prime",
+				       (answers[j] & PRIME_QUERY_SIEVED) ? "" : " (Miller-Rabin)");
+			j = i + nfar;
+			continue;
+		}
+		n = strtoull(argv[i], NULL, 0);
+		printf("%llu: %s\n", n, is_prime(bits, n) ? "prime" : "not prime");
+		j = i + 1;
+	}
+
+	if (bits != NULL)
+		munmap(bits, req.map_bytes);
+	close(fd);
+	return 0;
+}
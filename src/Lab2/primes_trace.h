@@ -0,0 +1,139 @@
+/*
+ * Trace events of the sieve, under the `primes' system of ftrace and perf,
+ * e.g. `trace-cmd record -e primes' or `perf record -e "primes:*"'. Each
+ * event carries the index of the thread it happened on, so that a timeline
+ * per thread can be drawn from them. Events cost a patched-out branch
+ * while disabled. This header is read again by the kernel's trace code, so
+ * the module must be built with its own directory on the include path, as
+ * the Makefile next to it does with `CFLAGS_primes.o := -I$(src)'.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM primes
+
+#if !defined(PRIMES_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PRIMES_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* A thread arrives at one of the barriers of the run: */
+TRACE_EVENT(prime_barrier_arrive,
+    TP_PROTO(unsigned long id),
+    TP_ARGS(id),
+    TP_STRUCT__entry(
+        __field(unsigned long, id)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+    ),
+    TP_printk("thread=%lu", __entry->id)
+);
+
+/* A thread leaves the barrier after waiting `wait_ns' for the others: */
+TRACE_EVENT(prime_barrier_depart,
+    TP_PROTO(unsigned long id, u64 wait_ns),
+    TP_ARGS(id, wait_ns),
+    TP_STRUCT__entry(
+        __field(unsigned long, id)
+        __field(u64, wait_ns)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->wait_ns = wait_ns;
+    ),
+    TP_printk("thread=%lu wait_ns=%llu", __entry->id, __entry->wait_ns)
+);
+
+/* A thread claims the base prime `prime' and crosses out its multiples: */
+TRACE_EVENT(prime_claim,
+    TP_PROTO(unsigned long id, unsigned long prime),
+    TP_ARGS(id, prime),
+    TP_STRUCT__entry(
+        __field(unsigned long, id)
+        __field(unsigned long, prime)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->prime = prime;
+    ),
+    TP_printk("thread=%lu prime=%lu", __entry->id, __entry->prime)
+);
+
+/* A thread starts on the segment, or window, of the odd integers within [lo, hi]: */
+TRACE_EVENT(prime_segment_start,
+    TP_PROTO(unsigned long id, unsigned long lo, unsigned long hi),
+    TP_ARGS(id, lo, hi),
+    TP_STRUCT__entry(
+        __field(unsigned long, id)
+        __field(unsigned long, lo)
+        __field(unsigned long, hi)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->lo = lo;
+        __entry->hi = hi;
+    ),
+    TP_printk("thread=%lu lo=%lu hi=%lu", __entry->id, __entry->lo, __entry->hi)
+);
+
+/* A thread is done with the segment starting at `lo', crossing out `marks' in it: */
+TRACE_EVENT(prime_segment_end,
+    TP_PROTO(unsigned long id, unsigned long lo, unsigned long marks),
+    TP_ARGS(id, lo, marks),
+    TP_STRUCT__entry(
+        __field(unsigned long, id)
+        __field(unsigned long, lo)
+        __field(unsigned long, marks)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->lo = lo;
+        __entry->marks = marks;
+    ),
+    TP_printk("thread=%lu lo=%lu marks=%lu", __entry->id, __entry->lo, __entry->marks)
+);
+
+/* A thread steals `segments' segments from the deque of the thread `victim': */
+TRACE_EVENT(prime_steal,
+    TP_PROTO(unsigned long id, unsigned long victim, unsigned long segments),
+    TP_ARGS(id, victim, segments),
+    TP_STRUCT__entry(
+        __field(unsigned long, id)
+        __field(unsigned long, victim)
+        __field(unsigned long, segments)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->victim = victim;
+        __entry->segments = segments;
+    ),
+    TP_printk("thread=%lu victim=%lu segments=%lu", __entry->id, __entry->victim, __entry->segments)
+);
+
+/* A thread is done crossing out, and heads for the last barrier: */
+TRACE_EVENT(prime_thread_finish,
+    TP_PROTO(unsigned long id, unsigned long marks, unsigned long claims, u64 run_ns),
+    TP_ARGS(id, marks, claims, run_ns),
+    TP_STRUCT__entry(
+        __field(unsigned long, id)
+        __field(unsigned long, marks)
+        __field(unsigned long, claims)
+        __field(u64, run_ns)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->marks = marks;
+        __entry->claims = claims;
+        __entry->run_ns = run_ns;
+    ),
+    TP_printk("thread=%lu marks=%lu claims=%lu run_ns=%llu",
+              __entry->id, __entry->marks, __entry->claims, __entry->run_ns)
+);
+
+#endif /* PRIMES_TRACE_H */
+
+/* Outside of the guard, so that the events are defined when this is read again: */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE primes_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,521 @@
+/*
+ * Userspace build of the sieve engine of primes.c, for quick A/B runs and
+ * for profiling with perf, without building or loading the module. The
+ * engine is the one of the module, primes_engine.h, built on top of the
+ * stand-ins below for the kernel interfaces it uses: pthreads, C11-style
+ * atomic builtins and futexes. Threads are spawned as in prime_start(),
+ * and work items of workqueue mode run on threads of their own. The output
+ * is that of the module, on stdout instead of the kernel log. Parameters
+ * are given as on insmod.
+ * Build with: gcc -O2 -Wall -pthread -o primes_user primes_user.c
+ * Usage: ./primes_user [num_threads=N] [upper_bound=N] [lower_bound=N] [sync=NAME]
+ *                      [segmented=0|1] [segment_size=N] [steal=0|1] [workqueue=0|1|2]
+ *                      [chunk_size=N] [spin_us=N] [lock_stats=0|1] [pin_threads=0|1]
+ *                      [window_size=N] [print_primes=0|1] [count_only=0|1] [wheel=N]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* The kernel interfaces primes_engine.h uses, on top of libc: */
+typedef unsigned long long u64;
+typedef unsigned int u32;
+
+#define KERN_INFO ""
+#define KERN_ALERT ""
+#define KERN_ERR ""
+#define printk(...) printf(__VA_ARGS__)
+
+#ifndef __always_inline
+#define __always_inline inline __attribute__((__always_inline__))
+#endif
+#define ____cacheline_aligned_in_smp __attribute__((__aligned__(PRIME_CACHE_LINE)))
+#define PRIME_CACHE_LINE 64
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define U64_MAX ULLONG_MAX
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_USEC 1000ULL
+#define BITS_PER_BYTE CHAR_BIT
+#define BITS_PER_LONG (__SIZEOF_LONG__ * CHAR_BIT)
+#define BITS_TO_LONGS(n) DIV_ROUND_UP(n, BITS_PER_LONG)
+#define BITMAP_FIRST_WORD_MASK(start) (~0UL << ((start) & (BITS_PER_LONG - 1)))
+#define BITMAP_LAST_WORD_MASK(nbits) (~0UL >> (-(nbits) & (BITS_PER_LONG - 1)))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define round_up(x, y) ((((x) - 1) | ((__typeof__(x))((y) - 1))) + 1)
+#define round_down(x, y) ((x) & ~((__typeof__(x))((y) - 1)))
+#define min(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+#define min_t(t, a, b) min((t)(a), (t)(b))
+#define max_t(t, a, b) max((t)(a), (t)(b))
+
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+/* Threads are preempted anyway, there is nothing to give way to: */
+#define cond_resched() do { } while (0)
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder)
+{
+    *remainder = dividend % divisor;
+    return dividend / divisor;
+}
+
+static inline int fls64(u64 x)
+{
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static unsigned long int_sqrt(unsigned long n)
+{
+    unsigned long r = 0, b;
+
+    for (b = 1UL << (BITS_PER_LONG - 2); b > n; b >>= 2);
+    for (; b != 0; b >>= 2)
+    {
+        if (n >= r + b)
+        {
+            n -= r + b;
+            r = (r >> 1) + b;
+        }
+        else
+            r >>= 1;
+    }
+    return r;
+}
+
+/* Bit operations, the atomic ones relaxed as on the kernel: */
+#define hweight_long(w) __builtin_popcountl(w)
+
+static inline bool test_bit(unsigned long nr, const unsigned long *addr)
+{
+    return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline void __set_bit(unsigned long nr, unsigned long *addr)
+{
+    addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(unsigned long nr, unsigned long *addr)
+{
+    addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline void clear_bit(unsigned long nr, unsigned long *addr)
+{
+    __atomic_fetch_and(&addr[nr / BITS_PER_LONG], ~(1UL << (nr % BITS_PER_LONG)), __ATOMIC_RELAXED);
+}
+
+static unsigned long find_next_bit(const unsigned long *addr, unsigned long size, unsigned long offset)
+{
+    unsigned long w;
+
+    if (offset >= size)
+        return size;
+    w = READ_ONCE(addr[offset / BITS_PER_LONG]) & BITMAP_FIRST_WORD_MASK(offset);
+    offset = round_down(offset, BITS_PER_LONG);
+    while (w == 0)
+    {
+        offset += BITS_PER_LONG;
+        if (offset >= size)
+            return size;
+        w = READ_ONCE(addr[offset / BITS_PER_LONG]);
+    }
+    return min(offset + __builtin_ctzl(w), size);
+}
+
+#define find_first_bit(addr, size) find_next_bit(addr, size, 0)
+#define for_each_set_bit(bit, addr, size) \
+    for ((bit) = find_first_bit(addr, size); (bit) < (size); (bit) = find_next_bit(addr, size, (bit) + 1))
+
+static inline void bitmap_fill(unsigned long *dst, unsigned long nbits)
+{
+    memset(dst, 0xff, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+static unsigned long bitmap_weight(const unsigned long *src, unsigned long nbits)
+{
+    unsigned long k, w = 0;
+
+    for (k = 0; k < nbits / BITS_PER_LONG; k++)
+    {
+        w += hweight_long(src[k]);
+    }
+    if (nbits % BITS_PER_LONG)
+        w += hweight_long(src[k] & BITMAP_LAST_WORD_MASK(nbits));
+    return w;
+}
+
+/* Atomics, fully ordered where the kernel ones are: */
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic_dec_and_test(v) (__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST) == 0)
+#define atomic_long_set(v, i) __atomic_store_n(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic_long_fetch_add(i, v) __atomic_fetch_add(&(v)->counter, i, __ATOMIC_SEQ_CST)
+
+/* A test-and-test-and-set spin lock, which needs no initializer call, unlike pthread_spinlock_t: */
+typedef struct { int locked; } spinlock_t;
+
+#define DEFINE_SPINLOCK(x) spinlock_t x = { 0 }
+#define spin_lock_init(l) ((l)->locked = 0)
+
+static inline bool spin_trylock(spinlock_t *l)
+{
+    return !__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_lock(spinlock_t *l)
+{
+    while (!spin_trylock(l))
+    {
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED))
+            cpu_relax();
+    }
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+struct mutex {
+    pthread_mutex_t m;
+};
+
+#define DEFINE_MUTEX(x) struct mutex x = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_lock(l) pthread_mutex_lock(&(l)->m)
+#define mutex_trylock(l) (pthread_mutex_trylock(&(l)->m) == 0)
+#define mutex_unlock(l) pthread_mutex_unlock(&(l)->m)
+
+struct static_key_false {
+    bool enabled;
+};
+
+#define DEFINE_STATIC_KEY_FALSE(x) struct static_key_false x = { false }
+#define static_branch_unlikely(k) __builtin_expect((k)->enabled, 0)
+#define static_branch_enable(k) ((k)->enabled = true)
+#define static_branch_disable(k) ((k)->enabled = false)
+
+/*
+ * A wait queue is a futex word bumped by every wake-up, and the number of
+ * threads sleeping on it. Sleepers are counted before the condition is
+ * checked, and wq_has_sleeper() orders the condition being made true before
+ * the count is read, so that either the waker sees the sleeper or the
+ * sleeper sees the condition.
+ */
+typedef struct {
+    unsigned int seq;
+    unsigned int sleepers;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(wq) memset(wq, 0, sizeof(wait_queue_head_t))
+
+static inline bool wq_has_sleeper(wait_queue_head_t *wq)
+{
+    smp_mb();
+    return __atomic_load_n(&wq->sleepers, __ATOMIC_RELAXED) != 0;
+}
+
+static inline void wake_up(wait_queue_head_t *wq)
+{
+    __atomic_fetch_add(&wq->seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &wq->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+#define wait_event_interruptible(wq, condition)                                    \
+    ({                                                                             \
+        unsigned int __seq;                                                        \
+        __atomic_fetch_add(&(wq).sleepers, 1, __ATOMIC_SEQ_CST);                   \
+        while (__seq = __atomic_load_n(&(wq).seq, __ATOMIC_SEQ_CST), !(condition)) \
+            syscall(SYS_futex, &(wq).seq, FUTEX_WAIT_PRIVATE, __seq, NULL, NULL, 0); \
+        __atomic_fetch_sub(&(wq).sleepers, 1, __ATOMIC_SEQ_CST);                   \
+        0;                                                                         \
+    })
+
+/* Only ever waited for by joining the threads: */
+struct completion {
+    unsigned int done;
+};
+
+#define DECLARE_COMPLETION(x) struct completion x = { 0 }
+#define reinit_completion(c) WRITE_ONCE((c)->done, 0)
+#define complete_all(c) smp_store_release(&(c)->done, 1)
+
+static inline u32 prandom_u32_max(u32 ep_ro)
+{
+    static __thread u32 state;
+
+    if (state == 0)
+        state = (u32)(uintptr_t)&state | 1;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (u32)(((u64)state * ep_ro) >> 32);
+}
+
+/* Allocations are cache-line aligned, as the kernel's are for the aligned structures: */
+#define GFP_KERNEL 0
+#define NUMA_NO_NODE (-1)
+#define PAGE_SIZE 4096UL
+
+static inline size_t array_size(size_t a, size_t b)
+{
+    size_t bytes;
+
+    return __builtin_mul_overflow(a, b, &bytes) ? SIZE_MAX : bytes;
+}
+
+static inline void *kmalloc(size_t size, int flags)
+{
+    return aligned_alloc(PRIME_CACHE_LINE, round_up(max(size, (size_t)1), (size_t)PRIME_CACHE_LINE));
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, int flags)
+{
+    return (array_size(n, size) == SIZE_MAX) ? NULL : kmalloc(n * size, flags);
+}
+
+static inline void *kcalloc(size_t n, size_t size, int flags)
+{
+    void *p = kmalloc_array(n, size, flags);
+
+    if (p != NULL)
+        memset(p, 0, n * size);
+    return p;
+}
+
+#define kvmalloc_array kmalloc_array
+#define vmalloc(size) kmalloc(size, GFP_KERNEL)
+#define vmalloc_node(size, node) kmalloc(size, GFP_KERNEL)
+#define kfree free
+#define kvfree free
+#define vfree free
+
+/* The CPUs this process may run on stand for the online ones, all on node 0: */
+static cpu_set_t prime_online;
+
+#define cpu_online_mask (&prime_online)
+#define nr_cpu_ids CPU_SETSIZE
+#define cpu_to_node(cpu) 0
+#define num_online_cpus() CPU_COUNT(&prime_online)
+
+static inline unsigned int cpumask_next(int n, const cpu_set_t *mask)
+{
+    while ((++n < CPU_SETSIZE) && !CPU_ISSET(n, mask));
+    return n;
+}
+
+#define cpumask_first(mask) cpumask_next(-1, mask)
+
+/* There is no tracing outside the kernel, the events of primes_trace.h compile away: */
+static inline void prime_no_trace(unsigned long id, ...)
+{
+}
+
+#define trace_prime_claim(...) prime_no_trace(__VA_ARGS__)
+#define trace_prime_segment_start(...) prime_no_trace(__VA_ARGS__)
+#define trace_prime_segment_end(...) prime_no_trace(__VA_ARGS__)
+#define trace_prime_steal(...) prime_no_trace(__VA_ARGS__)
+#define trace_prime_barrier_arrive(...) prime_no_trace(__VA_ARGS__)
+#define trace_prime_barrier_depart(...) prime_no_trace(__VA_ARGS__)
+#define trace_prime_thread_finish(...) prime_no_trace(__VA_ARGS__)
+
+struct page;
+
+#include "primes_engine.h"
+
+/**
+ * Allocates the bitmap, with the spare word and the rest of the last page
+ * cleared as by the module. Pages are placed where they are first touched:
+ * past the words set up before the threads run, that is by the thread whose
+ * slice prime_fill_slice() gives them to, in even contiguous slices. Unlike
+ * prime_page_owner() in the module, this only roughly matches the thread
+ * crossing them out with sync=partitioned: segments go round-robin, and
+ * claims and steals go to whichever thread gets there first.
+ */
+static unsigned long *prime_alloc_bits(unsigned long words)
+{
+    unsigned long *bits;
+
+    prime_npages = DIV_ROUND_UP((words + 1) * sizeof(unsigned long), PAGE_SIZE);
+    bits = (unsigned long *)aligned_alloc(PAGE_SIZE, prime_npages * PAGE_SIZE);
+    if (bits != NULL)
+        memset(&bits[words], 0, prime_npages * PAGE_SIZE - words * sizeof(unsigned long));
+    return bits;
+}
+
+static void prime_free_bits(unsigned long *bits, struct page **pages, unsigned long npages)
+{
+    free(bits);
+}
+
+/* Parameters as the module starts out with, see primes.c: */
+static struct prime_config prime_user_cfg = {
+    .num_threads = 1,
+    .upper_bound = 10,
+    .sync = PRIME_SYNC_ATOMIC,
+    .chunk_size = 8,
+    .spin_us = 50,
+};
+
+/* Sets the parameter given as name=value, as insmod would: */
+static int prime_param(const char *arg)
+{
+    static const struct {
+        const char *name;
+        unsigned long *ulong;
+        bool *flag;
+    } params[] = {
+        {"num_threads", &prime_user_cfg.num_threads, NULL},
+        {"upper_bound", &prime_user_cfg.upper_bound, NULL},
+        {"lower_bound", &prime_user_cfg.lower_bound, NULL},
+        {"segment_size", &prime_user_cfg.segment_size, NULL},
+        {"workqueue", &prime_user_cfg.workqueue, NULL},
+        {"chunk_size", &prime_user_cfg.chunk_size, NULL},
+        {"spin_us", &prime_user_cfg.spin_us, NULL},
+        {"window_size", &prime_user_cfg.window_size, NULL},
+        {"wheel", &prime_user_cfg.wheel, NULL},
+        {"segmented", NULL, &prime_user_cfg.segmented},
+        {"steal", NULL, &prime_user_cfg.steal},
+        {"lock_stats", NULL, &prime_user_cfg.lock_stats},
+        {"pin_threads", NULL, &prime_user_cfg.pin_threads},
+        {"print_primes", NULL, &prime_user_cfg.print_primes},
+        {"count_only", NULL, &prime_user_cfg.count_only},
+    };
+    const char *val = strchr(arg, '=');
+    size_t len = val ? (size_t)(val - arg) : strlen(arg);
+    unsigned int i;
+
+    if (val == NULL)
+        return -EINVAL;
+    val++;
+    /* Unknown strategies are left to prime_setup() to report: */
+    if ((len == 4) && !strncmp(arg, "sync", len))
+    {
+        prime_user_cfg.sync = -EINVAL;
+        for (i = 0; i < ARRAY_SIZE(prime_sync_names); i++)
+        {
+            if (!strcmp(val, prime_sync_names[i]))
+                prime_user_cfg.sync = i;
+        }
+        return 0;
+    }
+    for (i = 0; i < ARRAY_SIZE(params); i++)
+    {
+        if ((strlen(params[i].name) != len) || strncmp(arg, params[i].name, len))
+            continue;
+        if (params[i].ulong)
+            *params[i].ulong = strtoul(val, NULL, 0);
+        else
+            *params[i].flag = (*val == '1') || (*val == 'y') || (*val == 'Y');
+        return 0;
+    }
+    return -EINVAL;
+}
+
+static void *prime_pthreadfn(void *st)
+{
+    prime_threadfn(st);
+    return NULL;
+}
+
+static void *prime_itemfn(void *st)
+{
+    prime_item_run((struct prime_stats *)st);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t *threads;
+    pthread_attr_t attr;
+    cpu_set_t set;
+    unsigned long i;
+    int ret;
+
+    for (i = 1; i < (unsigned long)argc; i++)
+    {
+        if (prime_param(argv[i]) != 0)
+        {
+            fprintf(stderr, "Unknown parameter %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    sched_getaffinity(0, sizeof(prime_online), &prime_online);
+
+    if (prime_setup(&prime_user_cfg, NULL, 0) != 0)
+        exit(EXIT_FAILURE);
+    threads = (pthread_t *)malloc(prime_cfg.num_threads * sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        printf("malloc for threads failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Work items need no barrier, so they start the computation right away: */
+    if (prime_queued)
+    {
+        atomic_set(&prime_pending, prime_cfg.num_threads);
+        WRITE_ONCE(prime_first_ns, ktime_get_ns());
+    }
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        pthread_attr_init(&attr);
+        if (prime_cfg.pin_threads || (prime_queued && (prime_cfg.workqueue == 2)))
+        {
+            CPU_ZERO(&set);
+            CPU_SET(prime_cpu[i], &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        ret = pthread_create(&threads[i], &attr, prime_queued ? prime_itemfn : prime_pthreadfn, &prime_stats[i]);
+        pthread_attr_destroy(&attr);
+        /* The threads already running would wait at the barrier forever: */
+        if (ret != 0)
+        {
+            printf("The %lu-th thread cannot be spawned!\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < prime_cfg.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    prime_print();
+    free(threads);
+    prime_free();
+    return 0;
+}